@@ -0,0 +1,32 @@
+#include "allocs.h"
+
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+// Per thread, so work on the texture loaders or the score writer does not
+// show up in a count taken on the GL thread, and nothing is shared.
+static thread_local uint64_t allocations = 0;
+
+uint64_t allocationCount() {
+    return allocations;
+}
+
+#ifdef RACE_COUNT_ALLOCATIONS
+// Replaces the global operator new and delete; the array forms end up
+// here too.
+void* operator new(size_t size) {
+    allocations++;
+    if (void* block = malloc(size ? size : 1)) return block;
+    throw bad_alloc();
+}
+
+void operator delete(void* block) noexcept {
+    free(block);
+}
+
+void operator delete(void* block, size_t) noexcept {
+    free(block);
+}
+#endif
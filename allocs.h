@@ -0,0 +1,19 @@
+#ifndef ALLOCS_H
+#define ALLOCS_H
+
+#include <stdint.h>
+
+// Built with RACE_COUNT_ALLOCATIONS defined, counts the heap allocations
+// each thread makes through operator new, so code that is meant to
+// allocate nothing on its hot path can be checked to do so. Otherwise
+// operator new is left alone and the count stays at zero.
+#ifdef RACE_COUNT_ALLOCATIONS
+const bool countingAllocations = true;
+#else
+const bool countingAllocations = false;
+#endif
+
+// Allocations made so far by the calling thread only.
+uint64_t allocationCount();
+
+#endif
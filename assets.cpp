@@ -0,0 +1,213 @@
+#include "assets.h"
+#include "bytes.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+static const char cacheMagic[4] = { 'R', 'C', 'A', 'C' };
+static const uint32_t cacheVersion = 1;
+static const size_t pixelAlign = 16;
+
+static const uint64_t fnvOffset = 14695981039346656037ULL;
+static const uint64_t fnvPrime = 1099511628211ULL;
+
+uint64_t hashCombine(uint64_t key, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        key ^= (value >> (8 * i)) & 0xFF;
+        key *= fnvPrime;
+    }
+    return key;
+}
+
+uint64_t hashFile(const char* filename) {
+    ifstream file(filename, ios::binary);
+    if (!file.is_open()) return 0;
+    uint64_t hash = fnvOffset;
+    char buffer[65536];
+    while (file) {
+        file.read(buffer, sizeof(buffer));
+        for (streamsize i = 0; i < file.gcount(); i++) {
+            hash ^= static_cast<uint8_t>(buffer[i]);
+            hash *= fnvPrime;
+        }
+    }
+    return hash;
+}
+
+static bool mapFile(AssetCache& cache, const char* filename) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (!view) {
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    cache.file = file;
+    cache.mapping = mapping;
+    cache.data = static_cast<const uint8_t*>(view);
+    cache.size = static_cast<size_t>(size.QuadPart);
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void* view = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED) return false;
+    cache.data = static_cast<const uint8_t*>(view);
+    cache.size = static_cast<size_t>(info.st_size);
+    cache.mapping = view;
+#endif
+    return true;
+}
+
+void closeAssetCache(AssetCache& cache) {
+#ifdef _WIN32
+    if (cache.data) UnmapViewOfFile(cache.data);
+    if (cache.mapping) CloseHandle(cache.mapping);
+    if (cache.file) CloseHandle(cache.file);
+#else
+    if (cache.data) munmap(const_cast<uint8_t*>(cache.data), cache.size);
+#endif
+    cache.data = nullptr;
+    cache.size = 0;
+    cache.mapping = cache.file = nullptr;
+    cache.images.clear();
+    cache.fresh.clear();
+    cache.freshPixels.clear();
+}
+
+void openAssetCache(AssetCache& cache, const char* filename) {
+    if (!mapFile(cache, filename)) return;
+
+    ByteReader in = { cache.data, cache.size, 0, true };
+    const uint8_t* magic = in.take(4);
+    uint32_t version = in.u32();
+    uint32_t count = in.u32();
+    if (!magic || memcmp(magic, cacheMagic, 4) != 0 || version != cacheVersion) {
+        closeAssetCache(cache);
+        return;
+    }
+    for (uint32_t i = 0; i < count && in.ok; i++) {
+        CachedImage image;
+        uint8_t nameLength = in.u8();
+        const uint8_t* name = in.take(nameLength);
+        image.key = in.u64();
+        image.width = static_cast<int>(in.u32());
+        image.height = static_cast<int>(in.u32());
+        uint64_t offset = in.u64();
+        uint64_t size = in.u64();
+        if (!in.ok || offset > cache.size || size > cache.size - offset ||
+            size != static_cast<uint64_t>(image.width) * image.height * 4) {
+            in.ok = false;
+            break;
+        }
+        image.name.assign(reinterpret_cast<const char*>(name), nameLength);
+        image.rgba = cache.data + offset;
+        cache.images.push_back(image);
+    }
+    if (!in.ok) {
+        cerr << "Ignoring damaged asset cache: " << filename << endl;
+        closeAssetCache(cache);
+    }
+}
+
+const CachedImage* findCachedImage(const AssetCache& cache, const string& name, uint64_t key) {
+    for (const CachedImage& image : cache.images)
+        if (image.name == name && image.key == key) return &image;
+    return nullptr;
+}
+
+void addCachedImage(AssetCache& cache, const string& name, uint64_t key, int width, int height, const uint8_t* rgba) {
+    cache.freshPixels.push_back(vector<uint8_t>(rgba, rgba + static_cast<size_t>(width) * height * 4));
+    CachedImage image = { name, key, width, height, cache.freshPixels.back().data() };
+    cache.fresh.push_back(image);
+}
+
+bool saveAssetCache(AssetCache& cache, const char* filename) {
+    vector<const CachedImage*> keep;
+    for (const CachedImage& image : cache.fresh) keep.push_back(&image);
+    for (const CachedImage& image : cache.images) {
+        bool replaced = false;
+        for (const CachedImage& added : cache.fresh) replaced = replaced || added.name == image.name;
+        if (!replaced) keep.push_back(&image);
+    }
+
+    vector<uint8_t> index;
+    for (char c : cacheMagic) index.push_back(static_cast<uint8_t>(c));
+    putU32(index, cacheVersion);
+    putU32(index, static_cast<uint32_t>(keep.size()));
+    size_t indexSize = index.size();
+    for (const CachedImage* image : keep) indexSize += 1 + min<size_t>(image->name.size(), 255) + 8 + 4 + 4 + 8 + 8;
+    uint64_t offset = (indexSize + pixelAlign - 1) / pixelAlign * pixelAlign;
+    for (const CachedImage* image : keep) {
+        size_t nameLength = min<size_t>(image->name.size(), 255);
+        uint64_t size = static_cast<uint64_t>(image->width) * image->height * 4;
+        index.push_back(static_cast<uint8_t>(nameLength));
+        index.insert(index.end(), image->name.begin(), image->name.begin() + nameLength);
+        putU64(index, image->key);
+        putU32(index, static_cast<uint32_t>(image->width));
+        putU32(index, static_cast<uint32_t>(image->height));
+        putU64(index, offset);
+        putU64(index, size);
+        offset = (offset + size + pixelAlign - 1) / pixelAlign * pixelAlign;
+    }
+    index.resize((index.size() + pixelAlign - 1) / pixelAlign * pixelAlign, 0);
+
+    // Written beside the old file and renamed over it, so a crash part way
+    // through never leaves a cache that looks valid but is not.
+    string temp = string(filename) + ".tmp";
+    bool ok;
+    {
+        ofstream file(temp.c_str(), ios::binary);
+        file.write(reinterpret_cast<const char*>(index.data()), index.size());
+        const char padding[pixelAlign] = {};
+        for (const CachedImage* image : keep) {
+            size_t size = static_cast<size_t>(image->width) * image->height * 4;
+            file.write(reinterpret_cast<const char*>(image->rgba), size);
+            file.write(padding, (pixelAlign - size % pixelAlign) % pixelAlign);
+        }
+        ok = file.good();
+    }
+    closeAssetCache(cache);
+    if (!ok) {
+        cerr << "Failed to write asset cache: " << temp << endl;
+        remove(temp.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    ok = MoveFileExA(temp.c_str(), filename, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    ok = rename(temp.c_str(), filename) == 0;
+#endif
+    if (!ok) {
+        cerr << "Failed to replace asset cache: " << filename << endl;
+        remove(temp.c_str());
+    }
+    return ok;
+}
@@ -0,0 +1,55 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <stdint.h>
+
+// Cooked asset cache: decoded RGBA images kept in one file that is mapped
+// into memory on the next launch, so textures upload straight from the
+// page cache instead of going through PNG inflate again. Each image is
+// stored under a name and a key; the key hashes everything the pixels were
+// made from, so a changed source file simply misses.
+//
+// File layout, little-endian: "RCAC", u32 version, u32 image count, then
+// per image a u8 name length, the name, u64 key, u32 width, u32 height,
+// u64 offset and u64 size of its pixels. Pixels start 16-byte aligned.
+
+struct CachedImage {
+    std::string name;
+    uint64_t key;
+    int width, height;
+    const uint8_t* rgba;   // into the mapping or the cache's freshPixels
+};
+
+struct AssetCache {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    void* mapping = nullptr;       // platform handles behind data
+    void* file = nullptr;
+    std::vector<CachedImage> images;
+    // Cooked this run and not yet saved; these win over mapped images of
+    // the same name.
+    std::vector<CachedImage> fresh;
+    std::vector<std::vector<uint8_t> > freshPixels;
+};
+
+// Maps the cache file if there is a valid one. A missing or damaged file
+// just leaves the cache empty.
+void openAssetCache(AssetCache& cache, const char* filename);
+void closeAssetCache(AssetCache& cache);
+
+const CachedImage* findCachedImage(const AssetCache& cache, const std::string& name, uint64_t key);
+// Copies the pixels, to be written by the next saveAssetCache().
+void addCachedImage(AssetCache& cache, const std::string& name, uint64_t key, int width, int height, const uint8_t* rgba);
+// Writes the fresh images and every mapped one they do not replace to a
+// new file and swaps it in. The cache is closed afterwards.
+bool saveAssetCache(AssetCache& cache, const char* filename);
+
+// FNV-1a over a file's bytes, or 0 if it cannot be read.
+uint64_t hashFile(const char* filename);
+// Folds another value into a key.
+uint64_t hashCombine(uint64_t key, uint64_t value);
+
+#endif
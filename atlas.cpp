@@ -0,0 +1,208 @@
+#include "atlas.h"
+#include "stb_image.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+// Transparent gap left between packed images, and the grid they start on.
+// Both are in level-0 texels; an 8 texel gap keeps the first three mip
+// levels from blending neighbouring images together.
+static const int atlasPadding = 8;
+static const int atlasAlign = 8;
+
+static int alignUp(int value) {
+    return (value + atlasAlign - 1) / atlasAlign * atlasAlign;
+}
+
+AtlasImage loadAtlasImage(const char* filename) {
+    AtlasImage image;
+    int channels;
+    unsigned char* data = stbi_load(filename, &image.width, &image.height, &channels, 4);
+    if (!data) {
+        cerr << "Failed to load texture: " << filename << endl;
+        return whiteAtlasImage();
+    }
+    image.rgba.assign(data, data + static_cast<size_t>(image.width) * image.height * 4);
+    stbi_image_free(data);
+    return image;
+}
+
+size_t atlasImageBytes(const char* filename) {
+    int width, height, channels;
+    if (!stbi_info(filename, &width, &height, &channels)) return 0;
+    return static_cast<size_t>(width) * height * 4;
+}
+
+AtlasImage whiteAtlasImage() {
+    AtlasImage image;
+    image.width = image.height = 4;
+    image.rgba.assign(4 * 4 * 4, 255);
+    return image;
+}
+
+// One pass of the box filter: out[i] averages the stretch of in that it
+// covers, with partial texels at either end weighted by how much of them
+// falls inside.
+static void boxFilter(const float* in, int inCount, size_t inStride, float* out, int outCount, size_t outStride) {
+    double scale = static_cast<double>(inCount) / outCount;
+    for (int i = 0; i < outCount; i++) {
+        double start = i * scale, end = (i + 1) * scale;
+        float sum[4] = { 0, 0, 0, 0 };
+        for (int s = static_cast<int>(start); s < end && s < inCount; s++) {
+            float weight = static_cast<float>(min<double>(end, s + 1) - max<double>(start, s));
+            for (int c = 0; c < 4; c++) sum[c] += in[s * inStride + c] * weight;
+        }
+        for (int c = 0; c < 4; c++) out[i * outStride + c] = sum[c] / static_cast<float>(scale);
+    }
+}
+
+AtlasImage resizeAtlasImage(const AtlasImage& image, int width, int height) {
+    width = max(1, width);
+    height = max(1, height);
+    if (width == image.width && height == image.height) return image;
+
+    // Filter premultiplied colour, so clear texels around a car do not
+    // darken its edges.
+    size_t inPixels = static_cast<size_t>(image.width) * image.height;
+    vector<float> source(inPixels * 4);
+    for (size_t p = 0; p < inPixels; p++) {
+        float alpha = image.rgba[p * 4 + 3] / 255.0f;
+        for (int c = 0; c < 3; c++) source[p * 4 + c] = image.rgba[p * 4 + c] * alpha;
+        source[p * 4 + 3] = image.rgba[p * 4 + 3];
+    }
+
+    vector<float> rows(static_cast<size_t>(width) * image.height * 4);
+    for (int y = 0; y < image.height; y++)
+        boxFilter(&source[static_cast<size_t>(y) * image.width * 4], image.width, 4,
+                  &rows[static_cast<size_t>(y) * width * 4], width, 4);
+    vector<float> result(static_cast<size_t>(width) * height * 4);
+    for (int x = 0; x < width; x++)
+        boxFilter(&rows[x * 4], image.height, static_cast<size_t>(width) * 4,
+                  &result[x * 4], height, static_cast<size_t>(width) * 4);
+
+    AtlasImage resized;
+    resized.width = width;
+    resized.height = height;
+    resized.rgba.resize(result.size());
+    for (size_t p = 0; p < result.size() / 4; p++) {
+        float alpha = result[p * 4 + 3];
+        for (int c = 0; c < 3; c++) {
+            float value = alpha > 0 ? result[p * 4 + c] * 255.0f / alpha : 0.0f;
+            resized.rgba[p * 4 + c] = static_cast<uint8_t>(min(255.0f, value + 0.5f));
+        }
+        resized.rgba[p * 4 + 3] = static_cast<uint8_t>(min(255.0f, alpha + 0.5f));
+    }
+    return resized;
+}
+
+bool layoutAtlas(Atlas& atlas, const vector<AtlasRect>& sizes, int maxSize) {
+    // Tallest first onto shelves roughly as wide as the atlas is tall.
+    vector<size_t> order(sizes.size());
+    double area = 0;
+    int widest = 0;
+    for (size_t i = 0; i < sizes.size(); i++) {
+        order[i] = i;
+        area += static_cast<double>(alignUp(sizes[i].width + atlasPadding)) * alignUp(sizes[i].height + atlasPadding);
+        widest = max(widest, alignUp(sizes[i].width + atlasPadding));
+    }
+    sort(order.begin(), order.end(), [&sizes](size_t a, size_t b) {
+        return sizes[a].height > sizes[b].height || (sizes[a].height == sizes[b].height && a < b);
+    });
+    int shelfWidth = min(maxSize, max(widest, static_cast<int>(ceil(sqrt(area)))));
+
+    atlas.rects = sizes;
+    int x = 0, y = 0, shelfHeight = 0, width = 0;
+    for (size_t i : order) {
+        AtlasRect& rect = atlas.rects[i];
+        if (x > 0 && x + rect.width > shelfWidth) {
+            y += shelfHeight;
+            x = shelfHeight = 0;
+        }
+        rect.x = x;
+        rect.y = y;
+        x += alignUp(rect.width + atlasPadding);
+        shelfHeight = max(shelfHeight, alignUp(rect.height + atlasPadding));
+        width = max(width, x);
+    }
+    int height = y + shelfHeight;
+    if (width > maxSize || height > maxSize) {
+        cerr << "Sprite atlas needs " << width << "x" << height << ", more than the "
+             << maxSize << " pixel texture limit" << endl;
+        atlas.width = atlas.height = 0;
+        atlas.regions.assign(sizes.size(), wholeTexture);
+        return false;
+    }
+
+    atlas.width = width;
+    atlas.height = height;
+    atlas.regions.resize(sizes.size());
+    for (size_t i = 0; i < sizes.size(); i++) {
+        const AtlasRect& rect = atlas.rects[i];
+        SpriteUV& uv = atlas.regions[i];
+        uv.u0 = (rect.x + 0.5f) / width;
+        uv.v0 = (rect.y + 0.5f) / height;
+        uv.u1 = (rect.x + rect.width - 0.5f) / width;
+        uv.v1 = (rect.y + rect.height - 0.5f) / height;
+    }
+    return true;
+}
+
+void composeAtlas(const Atlas& atlas, const vector<AtlasImage>& images, vector<AtlasImage>& levels) {
+    levels.assign(1, AtlasImage());
+    AtlasImage& base = levels[0];
+    base.width = atlas.width;
+    base.height = atlas.height;
+    base.rgba.assign(static_cast<size_t>(atlas.width) * atlas.height * 4, 0);
+    for (size_t i = 0; i < images.size(); i++) {
+        const AtlasImage& image = images[i];
+        const AtlasRect& rect = atlas.rects[i];
+        for (int row = 0; row < image.height; row++)
+            memcpy(&base.rgba[(static_cast<size_t>(rect.y + row) * atlas.width + rect.x) * 4],
+                   &image.rgba[static_cast<size_t>(row) * image.width * 4], image.width * 4);
+    }
+    // Full chain down to 1x1 so the cars stay smooth when the window is
+    // shrunk.
+    while (levels.back().width > 1 || levels.back().height > 1) {
+        const AtlasImage& last = levels.back();
+        AtlasImage next = resizeAtlasImage(last, last.width / 2, last.height / 2);
+        levels.push_back(next);
+    }
+}
+
+void uploadAtlas(Atlas& atlas, const vector<AtlasLevel>& levels) {
+    atlas.bytes = 0;
+    glGenTextures(1, &atlas.texture);
+    glBindTexture(GL_TEXTURE_2D, atlas.texture);
+    for (size_t mip = 0; mip < levels.size(); mip++) {
+        const AtlasLevel& level = levels[mip];
+        glTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(mip), GL_RGBA, level.width, level.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, level.rgba);
+        atlas.bytes += static_cast<size_t>(level.width) * level.height * 4;
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, levels.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+bool buildAtlas(Atlas& atlas, const vector<AtlasImage>& images) {
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    vector<AtlasRect> sizes;
+    for (const AtlasImage& image : images) {
+        AtlasRect size = { 0, 0, image.width, image.height };
+        sizes.push_back(size);
+    }
+    if (!layoutAtlas(atlas, sizes, maxSize)) return false;
+
+    vector<AtlasImage> levels;
+    composeAtlas(atlas, images, levels);
+    vector<AtlasLevel> upload;
+    for (const AtlasImage& level : levels) {
+        AtlasLevel view = { level.width, level.height, level.rgba.data() };
+        upload.push_back(view);
+    }
+    uploadAtlas(atlas, upload);
+    return true;
+}
@@ -0,0 +1,64 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+#include "sprites.h"
+
+// Several images packed into one texture, so everything drawn from it can
+// share a bind and a batched draw.
+
+struct AtlasImage {
+    int width, height;
+    std::vector<uint8_t> rgba;
+};
+
+// Where an image sits in the atlas, in level-0 texels.
+struct AtlasRect {
+    int x, y, width, height;
+};
+
+// One mip level ready to upload.
+struct AtlasLevel {
+    int width, height;
+    const uint8_t* rgba;
+};
+
+struct Atlas {
+    GLuint texture = 0;
+    int width = 0, height = 0;
+    std::vector<AtlasRect> rects;    // one per image, in the order given
+    std::vector<SpriteUV> regions;   // the same, in texture coordinates
+    size_t bytes = 0;                // texture memory, every mip level included
+};
+
+// Loads a PNG as RGBA. A file that cannot be read becomes a small white
+// image, so the sprite still shows up as a box.
+AtlasImage loadAtlasImage(const char* filename);
+// What loadAtlasImage() would hold for the file, from its header alone;
+// 0 if it cannot be read.
+size_t atlasImageBytes(const char* filename);
+// Solid white, for flat quads drawn through the atlas with a vertex colour.
+AtlasImage whiteAtlasImage();
+// Box-filtered resize: every output texel averages the source area it
+// covers, in premultiplied alpha.
+AtlasImage resizeAtlasImage(const AtlasImage& image, int width, int height);
+
+// Works out where images of the given sizes go (only width and height of
+// each rect are read) by packing them onto shelves, and fills in the
+// atlas size, rects and regions. Regions are inset half a texel so linear
+// filtering never reads a neighbouring image. Returns false if the atlas
+// would be larger than maxSize; every sprite then draws untextured.
+bool layoutAtlas(Atlas& atlas, const std::vector<AtlasRect>& sizes, int maxSize);
+// Copies the images into their rects and builds the full mip chain, each
+// level box filtered from the one before.
+void composeAtlas(const Atlas& atlas, const std::vector<AtlasImage>& images, std::vector<AtlasImage>& levels);
+// Creates the texture from a mip chain; needs the GL context.
+void uploadAtlas(Atlas& atlas, const std::vector<AtlasLevel>& levels);
+
+// All three in one go.
+bool buildAtlas(Atlas& atlas, const std::vector<AtlasImage>& images);
+
+#endif
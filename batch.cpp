@@ -0,0 +1,64 @@
+#include "batch.h"
+#include "headless.h"
+#include "scores.h"
+
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+using namespace std;
+
+static RaceResult runJob(const BatchJob& job, float simRate, unsigned long maxTicks) {
+    RaceState race;
+    ReplayPlayer player;
+    if (job.replay) startPlayback(player, *job.replay, race);
+    else initRace(race, job.difficulty, job.seed, 1.0f / simRate);
+
+    RaceInput input;
+    while (!race.gameOver && race.tick < maxTicks) {
+        if (job.replay) {
+            if (!nextReplayInput(player, input)) break;
+        } else {
+            input = autopilotInput(race);
+        }
+        stepRace(race, input);
+    }
+
+    RaceResult result;
+    result.score = race.score;
+    result.position = race.playerPosition;
+    result.lap = min(race.lap, totalLaps);
+    result.health = race.player.health;
+    result.collisions = race.collisions;
+    result.ticks = race.tick;
+    result.finished = race.gameOver && race.player.health > 0;
+    result.timedOut = !race.gameOver && race.tick >= maxTicks;
+    return result;
+}
+
+void runBatch(const vector<BatchJob>& jobs, vector<RaceResult>& results,
+              int threads, float simRate, unsigned long maxTicks) {
+    results.assign(jobs.size(), RaceResult());
+    atomic<size_t> nextJob(0);
+    auto worker = [&]() {
+        for (size_t i = nextJob++; i < jobs.size(); i = nextJob++)
+            results[i] = runJob(jobs[i], simRate, maxTicks);
+    };
+
+    vector<thread> pool;
+    for (int i = 1; i < threads; i++) pool.emplace_back(worker);
+    worker();
+    for (auto& t : pool) t.join();
+}
+
+void writeBatchCsv(ostream& out, const vector<BatchJob>& jobs, const vector<RaceResult>& results) {
+    out << "race,source,seed,difficulty,score,position,laps,health,collisions,ticks,finished,timed_out\n";
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const BatchJob& job = jobs[i];
+        const RaceResult& r = results[i];
+        out << i << ',' << (job.replay ? job.name : "autopilot") << ',' << job.seed << ','
+            << difficultyName(job.difficulty) << ',' << r.score << ',' << r.position << ',' << r.lap << ','
+            << r.health << ',' << r.collisions << ',' << r.ticks << ',' << (r.finished ? 1 : 0) << ','
+            << (r.timedOut ? 1 : 0) << '\n';
+    }
+}
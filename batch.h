@@ -0,0 +1,37 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <vector>
+#include <string>
+#include <ostream>
+#include <stdint.h>
+
+#include "sim.h"
+#include "replay.h"
+
+// Runs many independent races across worker threads. A job with a replay
+// plays its recorded inputs; otherwise the autopilot drives the player.
+
+struct BatchJob {
+    uint64_t seed;
+    Difficulty difficulty;
+    const Replay* replay;
+    std::string name;
+};
+
+struct RaceResult {
+    int score;
+    int position;
+    int lap;
+    int health;
+    int collisions;
+    unsigned long ticks;
+    bool finished;   // completed every lap in first place
+    bool timedOut;   // hit the tick limit before the race ended
+};
+
+void runBatch(const std::vector<BatchJob>& jobs, std::vector<RaceResult>& results,
+              int threads, float simRate, unsigned long maxTicks);
+void writeBatchCsv(std::ostream& out, const std::vector<BatchJob>& jobs, const std::vector<RaceResult>& results);
+
+#endif
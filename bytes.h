@@ -0,0 +1,104 @@
+#ifndef BYTES_H
+#define BYTES_H
+
+#include <vector>
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+// Little-endian helpers shared by the binary file formats.
+
+inline void putVarint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+inline bool getVarint(const uint8_t* data, size_t size, size_t& pos, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < size; shift += 7) {
+        uint8_t b = data[pos++];
+        value |= static_cast<uint64_t>(b & 0x7F) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+inline bool getVarint(const std::vector<uint8_t>& in, size_t& pos, uint64_t& value) {
+    return getVarint(in.data(), in.size(), pos, value);
+}
+
+inline void putU32(std::vector<uint8_t>& out, uint32_t value) {
+    for (int i = 0; i < 4; i++) out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+inline void putU64(std::vector<uint8_t>& out, uint64_t value) {
+    for (int i = 0; i < 8; i++) out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+inline void putFloat(std::vector<uint8_t>& out, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    putU32(out, bits);
+}
+
+inline uint32_t getU32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+inline uint64_t getU64(const uint8_t* p) {
+    return getU32(p) | (static_cast<uint64_t>(getU32(p + 4)) << 32);
+}
+
+inline float getFloat(const uint8_t* p) {
+    uint32_t bits = getU32(p);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+struct Crc32Table {
+    uint32_t entries[256];
+    Crc32Table() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            entries[i] = c;
+        }
+    }
+};
+
+// CRC-32 (the zlib one), for records that must notice a torn or damaged
+// write.
+inline uint32_t crc32(const uint8_t* data, size_t size) {
+    static const Crc32Table table;
+    uint32_t c = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; i++) c = table.entries[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+// Bounds-checked sequential reads; ok drops to false on the first overrun
+// and every later read returns zero.
+struct ByteReader {
+    const uint8_t* data;
+    size_t size;
+    size_t pos;
+    bool ok;
+
+    const uint8_t* take(size_t n) {
+        if (!ok || size - pos < n) {
+            ok = false;
+            return nullptr;
+        }
+        pos += n;
+        return data + pos - n;
+    }
+    uint8_t u8() { const uint8_t* p = take(1); return p ? *p : 0; }
+    uint32_t u32() { const uint8_t* p = take(4); return p ? getU32(p) : 0; }
+    uint64_t u64() { const uint8_t* p = take(8); return p ? getU64(p) : 0; }
+    float f32() { const uint8_t* p = take(4); return p ? getFloat(p) : 0.0f; }
+};
+
+#endif
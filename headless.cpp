@@ -0,0 +1,501 @@
+#include "headless.h"
+#include "replay.h"
+#include "batch.h"
+#include "scores.h"
+#include "scorelog.h"
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <fstream>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <sstream>
+
+using namespace std;
+
+RaceInput autopilotInput(const RaceState& race) {
+    RaceInput input = { true, false, false, false };
+    const Car& player = race.player;
+    const Traffic& traffic = race.traffic;
+    for (size_t i = 0; i < trafficCount(traffic); i++) {
+        float x = traffic.x[i], y = traffic.y[i];
+        if (y > player.y || y < player.y - 2 * carHeight) continue;
+        if (abs(x - player.x) >= carWidth) continue;
+        float roadMiddle = (roadLeftBound + roadRightBound) / 2;
+        if (x > player.x || (x == player.x && player.x > roadMiddle)) input.left = true;
+        else input.right = true;
+        break;
+    }
+    return input;
+}
+
+static bool parseDifficulty(const string& name, Difficulty& difficulty) {
+    if (name == "easy") difficulty = EASY;
+    else if (name == "medium") difficulty = MEDIUM;
+    else if (name == "hard") difficulty = HARD;
+    else return false;
+    return true;
+}
+
+struct HeadlessOptions {
+    unsigned long ticks;
+    uint64_t seed;
+    float simRate;
+    Difficulty difficulty;
+    string recordFile;
+    string replayFile;
+    int repeat;
+    unsigned long keyframeInterval;
+    long seekTick;
+    bool allDifficulties;
+    int batchRaces;
+    vector<string> batchReplays;
+    int threads;
+    unsigned long maxTicks;
+    string csvFile;
+    int traffic;
+    string bench;
+    // --scores queries.
+    bool scores;
+    bool difficultySet;
+    size_t top;
+    string per;
+    bool rankQuery;
+    int rankScore;
+    string scoreFile;
+};
+
+static void printUsage() {
+    cout << "Usage: Project1 --headless [--ticks=N] [--seed=N] [--sim-hz=N] [--difficulty=easy|medium|hard]" << endl;
+    cout << "                         [--record=FILE] [--keyframe-interval=N] [--traffic=N]" << endl;
+    cout << "       Project1 --headless --replay=FILE [--repeat=N] [--seek=TICK]" << endl;
+    cout << "       Project1 --headless --batch=N [--batch-replay=FILE]... [--seed=N] [--difficulty=easy|medium|hard|all]" << endl;
+    cout << "                         [--threads=N] [--max-ticks=N] [--csv=FILE]" << endl;
+    cout << "       Project1 --headless --bench=collisions [--traffic=N] [--seed=N]" << endl;
+    cout << "       Project1 --headless --bench=scores [--seed=N]" << endl;
+    cout << "       Project1 [--headless] --scores [--difficulty=easy|medium|hard|all] [--top=N] [--per=day|week]" << endl;
+    cout << "                         [--rank=SCORE] [--score-file=FILE]" << endl;
+}
+
+static void saveRecording(ReplayRecorder& recorder, const RaceState& race, const string& filename) {
+    finishRecording(recorder, race);
+    if (saveReplay(recorder, filename.c_str()))
+        cout << "Recorded " << race.tick << " ticks to " << filename << " (" << recorder.data.size() << " bytes)" << endl;
+}
+
+static int runSimulation(const HeadlessOptions& options) {
+    RaceState race;
+    initRace(race, options.difficulty, options.seed, 1.0f / options.simRate);
+    // Traffic stress: raise the car limit, spawn a car every tick and keep
+    // the race going however often the player is hit.
+    if (options.traffic > 0) {
+        race.maxTraffic = options.traffic;
+        race.aiSpawnInterval = 0;
+        race.endless = true;
+        resetRace(race);
+    }
+
+    // Only the first race is recorded; it is the one --seed reproduces.
+    ReplayRecorder recorder;
+    bool recording = !options.recordFile.empty();
+    if (recording) beginRecording(recorder, race, options.keyframeInterval);
+
+    unsigned long races = 0, finished = 0, collisions = 0;
+    long long totalScore = 0;
+    auto start = chrono::steady_clock::now();
+    for (unsigned long i = 0; i < options.ticks; i++) {
+        RaceInput input = autopilotInput(race);
+        if (recording) recordInput(recorder, race, input);
+        stepRace(race, input);
+        if (race.gameOver) {
+            if (recording) saveRecording(recorder, race, options.recordFile);
+            recording = false;
+            races++;
+            if (race.lap > totalLaps) finished++;
+            collisions += race.collisions;
+            totalScore += race.score;
+            race.seed = options.seed + races;
+            resetRace(race);
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    // --ticks ran out first, or the race was endless: keep what was played.
+    if (recording) saveRecording(recorder, race, options.recordFile);
+
+    cout << "Seed: " << options.seed << endl;
+    cout << "Ticks: " << options.ticks << endl;
+    cout << "Races: " << races << " (finished " << finished << ")" << endl;
+    cout << "Collisions: " << collisions + race.collisions << endl;
+    if (races > 0) cout << "Average score: " << totalScore / (long long)races << endl;
+    cout << "Last race: tick " << race.tick << ", " << trafficCount(race.traffic) << " cars, score " << race.score
+         << ", player at " << race.player.x << "," << race.player.y << endl;
+    cout << "Time: " << seconds << " s (" << (seconds > 0 ? options.ticks / seconds : 0) << " ticks/s)" << endl;
+    return 0;
+}
+
+static int seekTo(const Replay& replay, unsigned long tick) {
+    RaceState race;
+    ReplayPlayer player;
+    auto start = chrono::steady_clock::now();
+    bool reached = seekReplay(player, replay, race, tick);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << "Keyframes: " << replay.keyframes.size() << " every " << replay.keyframeInterval << " ticks" << endl;
+    cout << "Tick: " << race.tick << "  Lap: " << race.lap << "/" << totalLaps << "  Position: " << race.playerPosition
+         << "  Health: " << race.player.health << "  Score: " << race.score << "  Traffic: " << trafficCount(race.traffic) << endl;
+    cout << "Seek time: " << seconds * 1000.0 << " ms" << endl;
+    if (!reached) cerr << "Replay ends before tick " << tick << endl;
+    return reached ? 0 : 2;
+}
+
+static int runReplay(const HeadlessOptions& options) {
+    Replay replay;
+    if (!loadReplay(options.replayFile.c_str(), replay)) return 1;
+
+    RaceState race;
+    ReplayPlayer player;
+    if (options.seekTick >= 0) return seekTo(replay, options.seekTick);
+
+    unsigned long ticks = 0;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < options.repeat; i++) {
+        startPlayback(player, replay, race);
+        RaceInput input;
+        while (!race.gameOver && nextReplayInput(player, input)) {
+            stepRace(race, input);
+            ticks++;
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << "Seed: " << replay.seed << endl;
+    cout << "Ticks: " << race.tick << "  Lap: " << race.lap << "/" << totalLaps << "  Position: " << race.playerPosition
+         << "  Health: " << race.player.health << "  Score: " << race.score << endl;
+    cout << "Time: " << seconds << " s (" << (seconds > 0 ? ticks / seconds : 0) << " ticks/s)" << endl;
+    if (replay.complete && (race.tick != replay.finalTick || race.score != replay.finalScore)) {
+        cerr << "Replay diverged: recorded " << replay.finalTick << " ticks, score " << replay.finalScore << endl;
+        return 2;
+    }
+    return 0;
+}
+
+static int runBatchMode(const HeadlessOptions& options) {
+    vector<Replay> replays(options.batchReplays.size());
+    vector<BatchJob> jobs;
+    for (size_t i = 0; i < replays.size(); i++) {
+        if (!loadReplay(options.batchReplays[i].c_str(), replays[i])) return 1;
+        BatchJob job = { replays[i].seed, replays[i].difficulty, &replays[i], options.batchReplays[i] };
+        jobs.push_back(job);
+    }
+    for (int i = 0; i < options.batchRaces; i++) {
+        Difficulty difficulty = options.allDifficulties ? static_cast<Difficulty>(i % 3) : options.difficulty;
+        BatchJob job = { options.seed + i, difficulty, nullptr, "" };
+        jobs.push_back(job);
+    }
+
+    vector<RaceResult> results;
+    auto start = chrono::steady_clock::now();
+    runBatch(jobs, results, options.threads, options.simRate, options.maxTicks);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if (options.csvFile.empty()) {
+        writeBatchCsv(cout, jobs, results);
+    } else {
+        ofstream file(options.csvFile);
+        if (!file.is_open()) {
+            cerr << "Failed to write " << options.csvFile << endl;
+            return 1;
+        }
+        writeBatchCsv(file, jobs, results);
+    }
+
+    // Per-difficulty summary goes to stderr so the CSV can be piped.
+    unsigned long long ticks = 0;
+    for (int d = EASY; d <= HARD; d++) {
+        int races = 0, wins = 0, timeouts = 0;
+        long long totalScore = 0;
+        for (size_t i = 0; i < jobs.size(); i++) {
+            if (jobs[i].difficulty != d) continue;
+            races++;
+            wins += results[i].finished;
+            timeouts += results[i].timedOut;
+            totalScore += results[i].score;
+            ticks += results[i].ticks;
+        }
+        if (races == 0) continue;
+        cerr << (d == EASY ? "Easy" : d == MEDIUM ? "Medium" : "Hard") << ": " << races << " races, "
+             << wins * 100.0 / races << "% won, " << timeouts << " timed out, average score " << totalScore / races << endl;
+    }
+    cerr << "Time: " << seconds << " s on " << options.threads << " threads (" << (seconds > 0 ? jobs.size() / seconds : 0)
+         << " races/s, " << (seconds > 0 ? ticks / seconds : 0) << " ticks/s)" << endl;
+    return 0;
+}
+
+// Narrowphase microbenchmark: every car against every car, first one
+// overlaps() call per pair, then overlapMask() a block at a time.
+static int runCollisionBench(const HeadlessOptions& options) {
+    size_t n = options.traffic > 0 ? options.traffic : 2000;
+    vector<float> x(n), y(n);
+    Rng rng;
+    seedRng(rng, options.seed, 0);
+    for (size_t i = 0; i < n; i++) {
+        x[i] = roadLeftBound + randomFloat(rng) * (roadRightBound - roadLeftBound);
+        y[i] = randomFloat(rng) * n * carHeight / 3;
+    }
+    unsigned long rounds = max(1UL, 200000000UL / (n * n));
+    double pairs = static_cast<double>(rounds) * n * n;
+
+    unsigned long long scalarHits = 0;
+    auto start = chrono::steady_clock::now();
+    for (unsigned long r = 0; r < rounds; r++)
+        for (size_t a = 0; a < n; a++)
+            for (size_t b = 0; b < n; b++)
+                scalarHits += overlaps(x[a], y[a], x[b], y[b]);
+    double scalarSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    unsigned long long blockHits = 0;
+    start = chrono::steady_clock::now();
+    for (unsigned long r = 0; r < rounds; r++)
+        for (size_t a = 0; a < n; a++)
+            for (size_t b = 0; b < n; b += collisionBlock)
+                blockHits += __builtin_popcount(overlapMask(x[a], y[a], &x[b], &y[b], min(collisionBlock, n - b)));
+    double blockSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << "Cars: " << n << "  Pairs: " << pairs << "  Hits: " << scalarHits << endl;
+    cout << "Scalar: " << scalarSeconds << " s (" << (scalarSeconds > 0 ? pairs / scalarSeconds : 0) << " pairs/s)" << endl;
+    cout << "Block:  " << blockSeconds << " s (" << (blockSeconds > 0 ? pairs / blockSeconds : 0) << " pairs/s)" << endl;
+    if (blockHits != scalarHits) {
+        cerr << "Block narrowphase disagrees: " << blockHits << " hits" << endl;
+        return 2;
+    }
+    return 0;
+}
+
+// Score table benchmark on a made-up history of a million races: what the
+// score screen used to do every frame (read the whole history), loading it
+// into a ScoreTable once, and then what a frame and a finished race cost.
+static int runScoreBench(const HeadlessOptions& options) {
+    const size_t lines = 1000000;
+    Rng rng;
+    seedRng(rng, options.seed, 0);
+    string history;
+    int64_t when = 1700000000;
+    for (size_t i = 0; i < lines; i++) {
+        when += 30 + randomInt(rng, 600);
+        ScoreRecord record = { randomInt(rng, 40000), static_cast<Difficulty>(randomInt(rng, HARD + 1)), when };
+        history += formatScoreLine(record);
+        history += '\n';
+    }
+
+    auto start = chrono::steady_clock::now();
+    istringstream scan(history);
+    string line;
+    size_t read = 0;
+    while (getline(scan, line)) read += !line.empty();
+    double scanSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    ScoreTable table;
+    start = chrono::steady_clock::now();
+    istringstream in(history);
+    readScoreText(table, in);
+    double loadSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    const int frames = 100000, shown = 15;
+    long long checksum = 0;
+    start = chrono::steady_clock::now();
+    for (int f = 0; f < frames; f++)
+        for (int i = 0; i < shown; i++) checksum += table.records[table.all.ranked[i]].score;
+    double topSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    const int added = 1000;
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < added; i++) {
+        ScoreRecord record = { randomInt(rng, 40000), static_cast<Difficulty>(randomInt(rng, HARD + 1)), when + i };
+        addScore(table, record);
+    }
+    double addSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    const int queries = 100000;
+    int32_t lastDay = scoreDay(when);
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < queries; i++) {
+        checksum += scoreRank(table, table.byDifficulty[i % (HARD + 1)], randomInt(rng, 40000));
+        if (const ScoreRecord* best = bestScoreIn(table, table.all.bestByDay, lastDay - randomInt(rng, 3000)))
+            checksum += best->score;
+    }
+    double querySeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    bool ordered = true;
+    const vector<uint32_t>& ranked = table.all.ranked;
+    for (size_t i = 1; i < ranked.size(); i++)
+        ordered = ordered && table.records[ranked[i - 1]].score >= table.records[ranked[i]].score;
+    cout << "History: " << read << " lines, " << history.size() / (1024 * 1024) << " MB" << endl;
+    cout << "Reading it (old score screen, per frame): " << scanSeconds * 1000 << " ms" << endl;
+    cout << "Loading into the table (once): " << loadSeconds * 1000 << " ms, " << table.records.size() << " scores" << endl;
+    cout << "Top " << shown << " from memory: " << topSeconds * 1e9 / frames << " ns per frame (checksum " << checksum << ")" << endl;
+    cout << "Adding a finished race: " << addSeconds * 1e6 / added << " us" << endl;
+    cout << "Rank of a score plus best of a day: " << querySeconds * 1e9 / queries << " ns" << endl;
+    if (!ordered || table.records.size() != lines + added) {
+        cerr << "Score table out of order" << endl;
+        return 2;
+    }
+    return 0;
+}
+
+// Leaderboard export from the score history: the best N races, the best
+// race of each of the last N days or weeks, or where one score ranks.
+static int runScoreQuery(const HeadlessOptions& options) {
+    ScoreTable table;
+    const string& file = options.scoreFile;
+    if (file.empty()) {
+        // The game's own history. Until the first race after an update it
+        // is still only the old text file that the game will import.
+        if (FILE* existing = fopen(scoreLogFile, "rb")) {
+            fclose(existing);
+            if (!loadScoreLog(table, scoreLogFile)) return 1;
+        } else {
+            loadScoreText(table, legacyScoreFile);
+        }
+    } else if (file.size() >= 4 && file.compare(file.size() - 4, 4, ".txt") == 0) {
+        ifstream in(file.c_str());
+        if (!in) {
+            cerr << "Failed to open score history: " << file << endl;
+            return 1;
+        }
+        readScoreText(table, in);
+    } else if (!loadScoreLog(table, file.c_str())) {
+        return 1;
+    }
+    const ScoreIndex& index = options.difficultySet ? table.byDifficulty[options.difficulty] : table.all;
+    const char* which = options.difficultySet ? difficultyName(options.difficulty) : "all difficulties";
+
+    if (options.rankQuery) {
+        cout << "A score of " << options.rankScore << " ranks " << scoreRank(table, index, options.rankScore)
+             << " among " << index.ranked.size() << " races (" << which << ")" << endl;
+        return 0;
+    }
+
+    if (!options.per.empty()) {
+        // Newest first. Weeks are labelled with their Monday.
+        bool weeks = options.per == "week";
+        const map<int32_t, uint32_t>& best = weeks ? index.bestByWeek : index.bestByDay;
+        cout << (weeks ? "week" : "day") << ",score,difficulty,time" << endl;
+        size_t shown = 0;
+        for (auto at = best.rbegin(); at != best.rend() && shown < options.top; ++at, shown++) {
+            const ScoreRecord& record = table.records[at->second];
+            cout << formatScoreDay(weeks ? at->first * 7 - 3 : at->first) << "," << record.score << ","
+                 << difficultyName(record.difficulty) << "," << record.time << endl;
+        }
+        return 0;
+    }
+
+    cout << "rank,score,difficulty,date,time" << endl;
+    vector<uint32_t> top = topScores(index, options.top);
+    for (size_t rank = 0; rank < top.size(); rank++) {
+        const ScoreRecord& record = table.records[top[rank]];
+        // Equal scores share the rank of the first of them.
+        size_t shared = rank > 0 && record.score == table.records[top[rank - 1]].score
+                            ? scoreRank(table, index, record.score) : rank + 1;
+        cout << shared << "," << record.score << "," << difficultyName(record.difficulty) << ","
+             << formatScoreDate(record) << "," << record.time << endl;
+    }
+    return 0;
+}
+
+int runHeadless(int argc, char** argv) {
+    // A score query needs no window either, so --scores may come first too.
+    string mode = argc < 2 ? "" : argv[1];
+    if (mode != "--headless" && mode != "--scores") return -1;
+
+    HeadlessOptions options;
+    options.ticks = 1000000;
+    options.seed = 1;
+    options.simRate = defaultTickRate;
+    options.difficulty = MEDIUM;
+    options.repeat = 1;
+    options.keyframeInterval = defaultKeyframeInterval;
+    options.seekTick = -1;
+    options.allDifficulties = false;
+    options.batchRaces = 0;
+    options.threads = max(1, static_cast<int>(thread::hardware_concurrency()));
+    options.maxTicks = 100000;
+    options.traffic = 0;
+    options.scores = mode == "--scores";
+    options.difficultySet = false;
+    options.top = 10;
+    options.rankQuery = false;
+    options.rankScore = 0;
+    bool batch = false;
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        if (arg.compare(0, 8, "--ticks=") == 0) {
+            options.ticks = strtoul(arg.c_str() + 8, nullptr, 10);
+        } else if (arg.compare(0, 7, "--seed=") == 0) {
+            options.seed = strtoull(arg.c_str() + 7, nullptr, 10);
+        } else if (arg.compare(0, 9, "--sim-hz=") == 0) {
+            options.simRate = static_cast<float>(atof(arg.c_str() + 9));
+            if (options.simRate <= 0) {
+                cerr << "Invalid tick rate: " << arg.substr(9) << endl;
+                return 1;
+            }
+        } else if (arg == "--difficulty=all") {
+            options.allDifficulties = true;
+        } else if (arg.compare(0, 13, "--difficulty=") == 0) {
+            if (!parseDifficulty(arg.substr(13), options.difficulty)) {
+                cerr << "Unknown difficulty: " << arg.substr(13) << endl;
+                return 1;
+            }
+            options.difficultySet = true;
+        } else if (arg.compare(0, 9, "--record=") == 0) {
+            options.recordFile = arg.substr(9);
+        } else if (arg.compare(0, 9, "--replay=") == 0) {
+            options.replayFile = arg.substr(9);
+        } else if (arg.compare(0, 20, "--keyframe-interval=") == 0) {
+            options.keyframeInterval = strtoul(arg.c_str() + 20, nullptr, 10);
+        } else if (arg.compare(0, 7, "--seek=") == 0) {
+            options.seekTick = max(0L, atol(arg.c_str() + 7));
+        } else if (arg.compare(0, 8, "--batch=") == 0) {
+            options.batchRaces = max(0, atoi(arg.c_str() + 8));
+            batch = true;
+        } else if (arg.compare(0, 15, "--batch-replay=") == 0) {
+            options.batchReplays.push_back(arg.substr(15));
+            batch = true;
+        } else if (arg.compare(0, 10, "--threads=") == 0) {
+            options.threads = max(1, atoi(arg.c_str() + 10));
+        } else if (arg.compare(0, 12, "--max-ticks=") == 0) {
+            options.maxTicks = strtoul(arg.c_str() + 12, nullptr, 10);
+        } else if (arg.compare(0, 10, "--traffic=") == 0) {
+            options.traffic = max(0, atoi(arg.c_str() + 10));
+        } else if (arg == "--bench=collisions" || arg == "--bench=scores") {
+            options.bench = arg.substr(8);
+        } else if (arg.compare(0, 6, "--csv=") == 0) {
+            options.csvFile = arg.substr(6);
+        } else if (arg == "--scores") {
+            options.scores = true;
+        } else if (arg.compare(0, 6, "--top=") == 0) {
+            options.top = strtoul(arg.c_str() + 6, nullptr, 10);
+        } else if (arg == "--per=day" || arg == "--per=week") {
+            options.per = arg.substr(6);
+        } else if (arg.compare(0, 7, "--rank=") == 0) {
+            options.rankQuery = true;
+            options.rankScore = atoi(arg.c_str() + 7);
+        } else if (arg.compare(0, 13, "--score-file=") == 0) {
+            options.scoreFile = arg.substr(13);
+        } else if (arg.compare(0, 9, "--repeat=") == 0) {
+            options.repeat = max(1, atoi(arg.c_str() + 9));
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+    if (options.scores) return runScoreQuery(options);
+    if (options.bench == "scores") return runScoreBench(options);
+    if (!options.bench.empty()) return runCollisionBench(options);
+    if (batch) return runBatchMode(options);
+    if (!options.replayFile.empty()) return runReplay(options);
+    return runSimulation(options);
+}
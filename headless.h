@@ -0,0 +1,15 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include "sim.h"
+
+// Simple player policy used when nobody is at the keyboard: hold the
+// throttle and slide away from whatever car is ahead in our lane.
+RaceInput autopilotInput(const RaceState& race);
+
+// Command-line modes that run without a window: anything after --headless,
+// or a --scores query on its own. Returns -1 if argv does not ask for one,
+// otherwise the process exit code.
+int runHeadless(int argc, char** argv);
+
+#endif
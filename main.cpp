@@ -9,70 +9,82 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#include "sim.h"
+#include "headless.h"
+#include "replay.h"
+#include "sprites.h"
+#include "textures.h"
+#include "text.h"
+#include "allocs.h"
+#include "scorelog.h"
+
 #include <iostream>
 #include <vector>
 #include <string>
-#include <sstream>
+#include <cstdio>
 #include <cmath>
 #include <fstream>
 #include <ctime>
 #include <cctype>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
 
 using namespace std;
 
-const int windowWidth = 2048;
-const int windowHeight = 1152;
-
-GLuint roadTex, playerTex, car1Tex, car2Tex, car3Tex;
-
-float roadOffset = 0;
-float playerSpeed = 30.0f;
-float minSpeed = 30.0f;
-const float maxSpeed = 250.0f;
-const float acceleration = 0.5f;
-const float deceleration = 0.3f;
-const float brakeDecel = 1.5f;
+// The menu comes up while textures are still loading; a race only starts
+// once they are all resident, so Start waits in startRequested until then.
+GameTextures textures;
+bool texturesLoaded = false;
+bool startRequested = false;
+double windowOpenedTime = -1;
+
+// Every race so far, ranked; read from scoreLogFile once at startup and
+// appended to as each race ends. legacyScoreFile is the old text history,
+// imported the first time there is no log.
+ScoreTable scores;
+ScoreLog scoreLog;
+// As many as fit between the heading and the Back button.
+const size_t scoreRows = 16;
 
 bool keyUp = false, keyLeft = false, keyRight = false, keyBrake = false;
 
-enum Difficulty { EASY, MEDIUM, HARD };
-Difficulty currentDifficulty = MEDIUM;
-
 enum GameState { MENU, GAME, SCORES, SELECT_LEVEL, GAME_OVER, PAUSED };
 GameState currentState = MENU;
 
-struct Car {
-    float x, y;
-    float speed;
-    GLuint texture;
-    bool isPlayer;
-    int health = 5;
-};
-
-const float roadLeftBound = 300.0f;
-const float roadRightBound = 1400.0f;
-
-const float carHeight = 500.0f;
-const float carWidth = 300.0f;
-const float bottomMargin = 50.0f;
-const float horizontalMargin = 50.0f;
-const float collisionGap = 5.0f;
-const float collisionBuffer = 10.0f;
-
-Car player = { 800.0f, windowHeight - carHeight - bottomMargin, 30.0f, 0, true };
-vector<Car> aiCars;
-
-float raceDistance = 0;
-int lap = 1;
-int playerPosition = 1;
-bool gameOver = false;
-const float lapDistance = 20000.0f;
-const int totalLaps = 3;
-int score = 0;
-float scoreMultiplier = 2.0f;
-
-float gameOverTime = 0;
+RaceState race;
+RaceState previousRace;
+RaceState renderRace;
+
+// The simulation runs at simRate ticks per second no matter how often we
+// draw; frames bank real time in the accumulator and spend it in ticks.
+float simRate = defaultTickRate;
+float frameRate = 60.0f;
+double accumulator = 0;
+double lastFrameTime = 0;
+double nextFrameTime = 0;
+const double maxFrameSeconds = 0.25;
+
+// Races are seeded from the clock unless --seed pins them for reproduction.
+uint64_t fixedSeed = 0;
+// Picked on the level screen and applied when the next race starts, so a
+// paused race keeps the settings its replay was recorded with.
+Difficulty selectedDifficulty = MEDIUM;
+
+// Every race is recorded to lastRaceFile; --replay=FILE plays one back
+// through the same step instead of reading the keyboard.
+const char* lastRaceFile = "lastrace.rpl";
+ReplayRecorder recorder;
+Replay loadedReplay;
+ReplayPlayer replayPlayer;
+bool watchingReplay = false;
+
+double gameOverTime = 0;
 const float gameOverDelay = 3.0f;
+// Set by startGame() and cleared at game over: only a paused race that is
+// still going can be continued from the menu.
+bool raceInProgress = false;
 
 #ifdef _WIN32
 static DWORD lastCollisionSound = 0;
@@ -114,300 +126,247 @@ vector<Button> menuButtons;
 vector<Button> levelButtons;
 vector<Button> scoreButtons;
 
-GLuint loadTexture(const char* filename) {
-    int width, height, channels;
-    unsigned char* data = stbi_load(filename, &width, &height, &channels, 4);
-    if (!data) {
-        cerr << "Failed to load texture: " << filename << endl;
-        return 0;
+// Button backgrounds go out as one batch, then the labels over them.
+void drawButtons(const vector<Button>& buttons) {
+    for (const auto& button : buttons) {
+        float shade = button.hovered ? 0.7f : 0.5f;
+        drawSprite(textures.sprites.texture, button.x, button.y, button.width, button.height,
+                   textures.sprites.regions[atlasWhite], spriteColor(shade, shade, shade));
     }
-    GLuint textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_2D, textureID);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    stbi_image_free(data);
-    return textureID;
-}
-
-void drawTexturedQuad(GLuint texture, float x, float y, float w = 300, float h = carHeight) {
-    glEnable(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glBegin(GL_QUADS);
-    glTexCoord2f(0, 0); glVertex2f(x, y);
-    glTexCoord2f(1, 0); glVertex2f(x + w, y);
-    glTexCoord2f(1, 1); glVertex2f(x + w, y + h);
-    glTexCoord2f(0, 1); glVertex2f(x, y + h);
-    glEnd();
-    glDisable(GL_TEXTURE_2D);
-}
-
-void drawText(float x, float y, string text, float scale = 1.0f) {
-    glColor3f(1.0, 1.0, 1.0);
-    glRasterPos2f(x, y);
-    for (char c : text) {
-        glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, c);
+    flushSprites();
+    for (const auto& button : buttons) {
+        float textX = button.x + (button.width - textWidth(button.label)) / 2;
+        float textY = button.y + button.height / 2 + 6;
+        drawText(textX, textY, button.label, 1.0f);
     }
+    flushSprites();
 }
 
-void drawButton(const Button& button) {
-    glColor3f(button.hovered ? 0.7f : 0.5f, button.hovered ? 0.7f : 0.5f, button.hovered ? 0.7f : 0.5f);
-    glBegin(GL_QUADS);
-    glVertex2f(button.x, button.y);
-    glVertex2f(button.x + button.width, button.y);
-    glVertex2f(button.x + button.width, button.y + button.height);
-    glVertex2f(button.x, button.y + button.height);
-    glEnd();
-    float textX = button.x + (button.width - button.label.length() * 12) / 2;
-    float textY = button.y + button.height / 2 + 6;
-    drawText(textX, textY, button.label, 1.0f);
+double elapsedSeconds() {
+    static const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
 }
 
-bool checkCollision(const Car& a, const Car& b) {
-    return abs(a.x - b.x) < (carWidth - collisionBuffer) &&
-           abs(a.y - b.y) < (carHeight - collisionBuffer);
-}
-
-void resolvePlayerAICollision(Car& player, Car& aiCar) {
-    float overlapX = carWidth - abs(player.x - aiCar.x);
-    float overlapY = carHeight - abs(player.y - aiCar.y);
+// A piece of HUD text, re-formatted only when the number it shows changes,
+// so frames where nothing moved just queue the cached glyphs.
+struct HudSegment {
+    const char* format;   // printf format, given the value and then extra
+    long extra = 0;
+    bool valid = false;
+    long value = 0;
+    string text = "";
+    float width = 0;
+};
 
-    if (overlapY < overlapX) {
-        if (player.y < aiCar.y) {
-            aiCar.y = player.y + carHeight + collisionGap;
-            aiCar.speed = max(minSpeed, playerSpeed * 0.9f);
-        } else {
-            player.y = aiCar.y + carHeight + collisionGap;
-            playerSpeed = max(minSpeed, aiCar.speed * 0.9f);
-        }
-    } else {
-        if (player.x < aiCar.x) {
-            player.x = aiCar.x - carWidth - collisionGap;
-        } else {
-            player.x = aiCar.x + carWidth + collisionGap;
-        }
-        playerSpeed = max(minSpeed, playerSpeed * 0.95f);
-        aiCar.speed = max(minSpeed, aiCar.speed * 0.95f);
-    }
+HudSegment raceHud[] = {
+    { "Speed: %ld km/h  " }, { "Lap: %ld/%ld  ", totalLaps },
+    { "Distance: %ldkm/%ldkm  ", static_cast<long>(lapDistance * totalLaps / 1000.0f) },
+    { "Health: %ld  " }, { "Position: %ld/4  " }, { "Score: %ld" },
+};
+HudSegment gameOverHud[] = {
+    { "Final Score: %ld" }, { "Final Lap: %ld/%ld", totalLaps }, { "Final Position: %ld/4" },
+    { "Returning to menu in %ld seconds" },
+};
+const string winTitle = "You Win!", loseTitle = "Game Over!";
 
-    if (player.x < roadLeftBound + horizontalMargin) player.x = roadLeftBound + horizontalMargin;
-    if (player.x > roadRightBound - horizontalMargin) player.x = roadRightBound - horizontalMargin;
-    if (aiCar.x < roadLeftBound + horizontalMargin) aiCar.x = roadLeftBound + horizontalMargin;
-    if (aiCar.x > roadRightBound - horizontalMargin) aiCar.x = roadRightBound - horizontalMargin;
+// Per race: how often the HUD was drawn, how often anything on it had to
+// be re-formatted, and what the other frames allocated on this thread
+// (which should be nothing; only counted in RACE_COUNT_ALLOCATIONS builds).
+long hudFrames = 0, hudRefreshes = 0;
+uint64_t hudIdleAllocations = 0;
 
-    cout << "Player-AI Collision: Player(" << player.x << ", " << player.y << "), AI("
-         << aiCar.x << ", " << aiCar.y << "), Overlap(X: " << overlapX << ", Y: " << overlapY << ")" << endl;
+bool setHudValue(HudSegment& segment, long value) {
+    if (segment.valid && segment.value == value) return false;
+    char buffer[96];
+    snprintf(buffer, sizeof(buffer), segment.format, value, segment.extra);
+    segment.text = buffer;
+    segment.width = textWidth(segment.text);
+    segment.value = value;
+    segment.valid = true;
+    return true;
 }
 
-void resolveAICarCollision(Car& car1, Car& car2) {
-    float overlapX = carWidth - abs(car1.x - car2.x);
-    float overlapY = carHeight - abs(car1.y - car2.y);
-
-    if (overlapY < overlapX) {
-        if (car1.y < car2.y) {
-            car2.y = car1.y + carHeight + collisionGap;
-            car2.speed = max(minSpeed, car1.speed * 0.9f);
-        } else {
-            car1.y = car2.y + carHeight + collisionGap;
-            car1.speed = max(minSpeed, car2.speed * 0.9f);
+void drawHUD() {
+    if (currentState != GAME && currentState != GAME_OVER && currentState != PAUSED) return;
+    uint64_t allocationsBefore = allocationCount();
+    bool changed = false;
+    if (!race.gameOver) {
+        long values[] = { static_cast<long>(race.playerSpeed), race.lap, static_cast<long>(race.raceDistance / 1000.0f),
+                          race.player.health, race.playerPosition, race.score };
+        float x = 20;
+        for (size_t i = 0; i < sizeof(raceHud) / sizeof(raceHud[0]); i++) {
+            changed = setHudValue(raceHud[i], values[i]) || changed;
+            drawText(x, 30, raceHud[i].text, 1.0f);
+            x += raceHud[i].width;
         }
     } else {
-        if (car1.x < car2.x) {
-            car1.x = car2.x - carWidth - collisionGap;
-        } else {
-            car1.x = car2.x + carWidth + collisionGap;
+        long values[] = { race.score, race.lap, race.playerPosition,
+                          static_cast<long>(gameOverDelay - (elapsedSeconds() - gameOverTime)) };
+        float x = windowWidth / 2 - 200, y = windowHeight / 2 - 100;
+        drawText(x, y, race.playerPosition == 1 && race.lap > totalLaps ? winTitle : loseTitle, 2.0f);
+        for (size_t i = 0; i < sizeof(gameOverHud) / sizeof(gameOverHud[0]); i++) {
+            changed = setHudValue(gameOverHud[i], values[i]) || changed;
+            drawText(x, y + (i + 1) * textLineHeight(2.0f), gameOverHud[i].text, 2.0f);
         }
-        car1.speed = max(minSpeed, car1.speed * 0.95f);
-        car2.speed = max(minSpeed, car2.speed * 0.95f);
     }
-
-    if (car1.x < roadLeftBound + horizontalMargin) car1.x = roadLeftBound + horizontalMargin;
-    if (car1.x > roadRightBound - horizontalMargin) car1.x = roadRightBound - horizontalMargin;
-    if (car2.x < roadLeftBound + horizontalMargin) car2.x = roadLeftBound + horizontalMargin;
-    if (car2.x > roadRightBound - horizontalMargin) car2.x = roadRightBound - horizontalMargin;
-
-    cout << "AI-AI Collision: Car1(" << car1.x << ", " << car1.y << "), Car2("
-         << car2.x << ", " << car2.y << "), Overlap(X: " << overlapX << ", Y: " << overlapY << ")" << endl;
+    hudFrames++;
+    if (changed) hudRefreshes++;
+    else hudIdleAllocations += allocationCount() - allocationsBefore;
 }
 
-float lastAISpawnTime = 0;
-float aiSpawnInterval = 2.0f;
-
-void updateAI() {
-    float aggression = 1.0f + (lap - 1) * 0.5f;
-    float currentTime = glutGet(GLUT_ELAPSED_TIME) / 1000.0f;
-
-    if (currentTime - lastAISpawnTime > aiSpawnInterval && aiCars.size() < (currentDifficulty == EASY ? 2 : currentDifficulty == MEDIUM ? 3 : 4)) {
-        float x = roadLeftBound + horizontalMargin + (rand() % static_cast<int>(roadRightBound - roadLeftBound - 2 * horizontalMargin - carWidth));
-        GLuint tex = (rand() % 3 == 0) ? car1Tex : (rand() % 2 == 0) ? car2Tex : car3Tex;
-        aiCars.push_back({ x, static_cast<float>(-600 - (rand() % 400)), playerSpeed * (0.85f + static_cast<float>(rand()) / RAND_MAX * 0.3f), tex, false });
-        lastAISpawnTime = currentTime;
+void playCrashSound() {
+    #ifdef _WIN32
+    DWORD currentTime = GetTickCount();
+    if (currentTime - lastCollisionSound > 500) {
+        mciSendString(TEXT("stop crash"), NULL, 0, NULL);
+        mciSendString(TEXT("close crash"), NULL, 0, NULL);
+        mciSendString(TEXT("open \"CRASH.mp3\" type mpegvideo alias crash"), NULL, 0, NULL);
+        mciSendString(TEXT("play crash"), NULL, 0, NULL);
+        lastCollisionSound = currentTime;
     }
+    #endif
+}
 
-    for (auto it = aiCars.begin(); it != aiCars.end();) {
-        Car& car = *it;
-        float relativeSpeed = playerSpeed * (0.85f + static_cast<float>(rand()) / RAND_MAX * 0.3f);
-        car.speed = relativeSpeed;
-        car.y += car.speed * 0.5f;
-
-        if (car.y > -carHeight) {
-            if (car.x < player.x) car.x += 2.0f * aggression;
-            else if (car.x > player.x) car.x -= 2.0f * aggression;
-
-            float zigzag = sin(glutGet(GLUT_ELAPSED_TIME) * 0.001f + car.y * 0.01f) * 1.5f;
-            car.x += zigzag;
-
-            if (car.x < roadLeftBound + horizontalMargin) car.x = roadLeftBound + horizontalMargin;
-            if (car.x > roadRightBound - horizontalMargin) car.x = roadRightBound - horizontalMargin;
-
-            for (auto& other : aiCars) {
-                if (&car != &other && checkCollision(car, other)) {
-                    resolveAICarCollision(car, other);
-                }
-            }
-        }
-
-        if (car.y > windowHeight + 200) {
-            car.y = static_cast<float>(-600 - (rand() % 400));
-            car.speed = playerSpeed * (0.85f + static_cast<float>(rand()) / RAND_MAX * 0.3f);
-        }
+// update() only keeps its timer going while something moves on its own:
+// a race, the game-over countdown or textures still loading. Menus are
+// redrawn when they change instead, so an idle menu costs nothing.
+bool updatePending = false;
 
-        if (checkCollision(player, car)) {
-            player.health--;
-            resolvePlayerAICollision(player, car);
-            #ifdef _WIN32
-            DWORD currentTime = GetTickCount();
-            if (currentTime - lastCollisionSound > 500) {
-                mciSendString(TEXT("stop crash"), NULL, 0, NULL);
-                mciSendString(TEXT("close crash"), NULL, 0, NULL);
-                mciSendString(TEXT("open \"CRASH.mp3\" type mpegvideo alias crash"), NULL, 0, NULL);
-                mciSendString(TEXT("play crash"), NULL, 0, NULL);
-                lastCollisionSound = currentTime;
-            }
-            #endif
-            it = aiCars.erase(it);
-            if (player.health <= 0) {
-                gameOver = true;
-                gameOverTime = currentTime;
-            }
-        } else {
-            ++it;
-        }
-    }
+bool needsUpdates() {
+    return currentState == GAME || currentState == GAME_OVER || !texturesLoaded;
+}
 
-    playerPosition = 1;
-    for (auto& car : aiCars)
-        if (car.y > player.y)
-            playerPosition++;
+void wakeUpdates() {
+    if (updatePending || !needsUpdates()) return;
+    // Time spent idle is not owed to the simulation.
+    lastFrameTime = nextFrameTime = elapsedSeconds();
+    updatePending = true;
+    glutTimerFunc(0, update, 0);
 }
 
-void drawHUD() {
-    if (currentState == GAME || currentState == GAME_OVER || currentState == PAUSED) {
-        stringstream hud;
-        if (!gameOver) {
-            hud << "Speed: " << (int)playerSpeed << " km/h  "
-                << "Lap: " << lap << "/" << totalLaps << "  "
-                << "Distance: " << (int)(raceDistance / 1000.0f) << "km/" << (int)(lapDistance * totalLaps / 1000.0f) << "km  "
-                << "Health: " << player.health << "  "
-                << "Position: " << playerPosition << "/4  "
-                << "Score: " << score;
-            drawText(20, 30, hud.str(), 1.0f);
-        } else {
-            hud << (playerPosition == 1 && lap > totalLaps ? "You Win!" : "Game Over!") << "\n"
-                << "Final Score: " << score << "\n"
-                << "Final Lap: " << lap << "/" << totalLaps << "\n"
-                << "Final Position: " << playerPosition << "/4\n"
-                << "Returning to menu in " << (int)(gameOverDelay - (glutGet(GLUT_ELAPSED_TIME) / 1000.0f - gameOverTime)) << " seconds";
-            drawText(windowWidth / 2 - 200, windowHeight / 2 - 100, hud.str(), 2.0f);
-        }
-    }
+void changeState(GameState state) {
+    currentState = state;
+    glutPostRedisplay();
+    wakeUpdates();
 }
 
 void update(int value) {
-    float currentTime = glutGet(GLUT_ELAPSED_TIME) / 1000.0f;
-    if (!gameOver && currentState == GAME) {
-        if (keyUp) playerSpeed += acceleration;
-        if (keyBrake) playerSpeed -= brakeDecel;
-
-        if (playerSpeed < minSpeed) playerSpeed = minSpeed;
-        if (playerSpeed > maxSpeed) playerSpeed = maxSpeed;
-
-        if (keyLeft) player.x -= 10;
-        if (keyRight) player.x += 10;
-
-        if (player.x < roadLeftBound + horizontalMargin) player.x = roadLeftBound + horizontalMargin;
-        if (player.x > roadRightBound - horizontalMargin) player.x = roadRightBound - horizontalMargin;
-
-        if (player.y < bottomMargin) player.y = bottomMargin;
-        if (player.y > windowHeight - carHeight - bottomMargin) player.y = windowHeight - carHeight - bottomMargin;
-
-        raceDistance += playerSpeed * 0.5f;
-        score += static_cast<int>((raceDistance / 1000.0f) * scoreMultiplier);
+    double currentTime = elapsedSeconds();
+    double frameSeconds = min(currentTime - lastFrameTime, maxFrameSeconds);
+    lastFrameTime = currentTime;
+
+    if (!texturesLoaded && pollTextureLoading(textures)) {
+        texturesLoaded = true;
+        glutPostRedisplay();
+        if (startRequested) startGame();
+    }
 
-        if (raceDistance >= lapDistance * lap && lap <= totalLaps) lap++;
-        if (lap > totalLaps && playerPosition == 1) {
-            gameOver = true;
+    if (currentState == GAME) {
+        RaceInput input = { keyUp, keyLeft, keyRight, keyBrake };
+        bool replayEnded = false;
+        accumulator += frameSeconds;
+        while (accumulator >= race.tickSeconds && !race.gameOver) {
+            if (watchingReplay && !nextReplayInput(replayPlayer, input)) {
+                replayEnded = true;
+                break;
+            }
+            if (!watchingReplay) recordInput(recorder, race, input);
+            previousRace = race;
+            stepRace(race, input);
+            accumulator -= race.tickSeconds;
+            if (race.playerHit) playCrashSound();
+        }
+        if (race.gameOver || replayEnded) {
+            if (!watchingReplay) {
+                finishRecording(recorder, race);
+                saveReplay(recorder, lastRaceFile);
+                ScoreRecord record = { race.score, race.difficulty, static_cast<int64_t>(time(0)) };
+                recordScore(scoreLog, scores, record);
+            }
             gameOverTime = currentTime;
+            raceInProgress = false;
+            changeState(GAME_OVER);
+            cout << "HUD: " << hudFrames << " frames, " << hudRefreshes << " re-formatted";
+            if (countingAllocations) cout << ", " << hudIdleAllocations << " allocations on the rest";
+            cout << endl;
+            hudFrames = hudRefreshes = 0;
+            hudIdleAllocations = 0;
+            previousRace = race;
+            accumulator = 0;
         }
-
-        roadOffset += playerSpeed * 0.5f;
-        if (roadOffset >= windowHeight)
-            roadOffset = 0;
-
-        updateAI();
     } else if (currentState == GAME_OVER && currentTime - gameOverTime > gameOverDelay) {
         resetGame();
-        currentState = MENU;
+        changeState(MENU);
     }
+    updatePending = false;
+    if (!needsUpdates()) return;
     glutPostRedisplay();
-    glutTimerFunc(16, update, 0);
+
+    nextFrameTime += 1.0 / frameRate;
+    if (nextFrameTime < currentTime) nextFrameTime = currentTime;
+    updatePending = true;
+    glutTimerFunc(static_cast<unsigned int>((nextFrameTime - currentTime) * 1000.0), update, 0);
 }
 
 void drawMenu() {
     glClear(GL_COLOR_BUFFER_BIT);
-    drawTexturedQuad(roadTex, 0, 0, windowWidth, windowHeight);
+    drawSprite(textures.road, 0, 0, windowWidth, windowHeight, wholeTexture, roadTint(textures));
+    flushSprites();
     drawText(windowWidth / 2 - 200, 100, "2D Racing Game", 2.0f);
-    for (const auto& button : menuButtons) {
-        drawButton(button);
-    }
+    drawButtons(menuButtons);
+    if (!texturesLoaded)
+        drawText(windowWidth / 2 - 100, windowHeight - 150, startRequested ? "Starting once loaded..." : "Loading textures...", 1.0f);
     drawText(windowWidth / 2 - 100, windowHeight - 100, "N: New Game | S: Score | L: Level | E: Exit", 1.0f);
+    flushSprites();
     glutSwapBuffers();
 }
 
 void drawScores() {
     glClear(GL_COLOR_BUFFER_BIT);
-    drawTexturedQuad(roadTex, 0, 0, windowWidth, windowHeight);
+    drawSprite(textures.road, 0, 0, windowWidth, windowHeight, wholeTexture, roadTint(textures));
+    flushSprites();
     drawText(windowWidth / 2 - 100, 100, "High Scores", 2.0f);
 
-    ifstream file("scores.txt");
-    string line;
+    time_t now = time(0);
+    const ScoreRecord* today = bestScoreIn(scores, scores.all.bestByDay, scoreDay(now));
+    const ScoreRecord* thisWeek = bestScoreIn(scores, scores.all.bestByWeek, scoreWeek(now));
+    drawText(200, 150, "Best today: " + (today ? to_string(today->score) : string("-")) +
+             "   This week: " + (thisWeek ? to_string(thisWeek->score) : string("-")), 1.0f);
+
+    // Best first, straight from the table.
     int yOffset = 200;
-    while (getline(file, line) && yOffset < windowHeight - 150) {
-        drawText(200, yOffset, line, 1.0f);
+    vector<uint32_t> top = topScores(scores.all, scoreRows);
+    for (size_t rank = 0; rank < top.size(); rank++) {
+        const ScoreRecord& record = scores.records[top[rank]];
+        drawText(200, yOffset, to_string(rank + 1) + ". " + to_string(record.score), 1.0f);
+        drawText(500, yOffset, difficultyName(record.difficulty), 1.0f);
+        drawText(700, yOffset, formatScoreDate(record), 1.0f);
         yOffset += 50;
     }
-    file.close();
 
-    for (const auto& button : scoreButtons) {
-        drawButton(button);
-    }
+    drawButtons(scoreButtons);
     drawText(windowWidth / 2 - 50, windowHeight - 100, "B: Back", 1.0f);
+    flushSprites();
     glutSwapBuffers();
 }
 
 void drawLevelSelect() {
     glClear(GL_COLOR_BUFFER_BIT);
-    drawTexturedQuad(roadTex, 0, 0, windowWidth, windowHeight);
+    drawSprite(textures.road, 0, 0, windowWidth, windowHeight, wholeTexture, roadTint(textures));
+    flushSprites();
     drawText(windowWidth / 2 - 100, 100, "Select Level", 2.0f);
-    for (const auto& button : levelButtons) {
-        drawButton(button);
-    }
+    drawButtons(levelButtons);
     drawText(windowWidth / 2 - 50, windowHeight - 100, "B: Back", 1.0f);
+    flushSprites();
     glutSwapBuffers();
 }
 
 void drawScene() {
+    initText();
+    if (windowOpenedTime >= 0) {
+        cout << "First frame " << (elapsedSeconds() - windowOpenedTime) * 1000.0 << " ms after the window opened" << endl;
+        windowOpenedTime = -1;
+    }
     if (currentState == MENU) {
         drawMenu();
     } else if (currentState == SCORES) {
@@ -415,18 +374,40 @@ void drawScene() {
     } else if (currentState == SELECT_LEVEL) {
         drawLevelSelect();
     } else if (currentState == GAME || currentState == GAME_OVER || currentState == PAUSED) {
-        glClear(GL_COLOR_BUFFER_BIT);
-        drawTexturedQuad(roadTex, 0, -roadOffset, windowWidth, windowHeight);
-        drawTexturedQuad(roadTex, 0, -roadOffset + windowHeight, windowWidth, windowHeight);
+        float alpha = static_cast<float>(accumulator / race.tickSeconds);
+        interpolateRace(previousRace, race, alpha, renderRace);
 
-        for (auto& car : aiCars) drawTexturedQuad(car.texture, car.x, car.y);
-        drawTexturedQuad(player.texture, player.x, player.y);
+        glClear(GL_COLOR_BUFFER_BIT);
+        // One quad with the scroll in its texture coordinates; the road
+        // texture repeats vertically, so the seam is never on screen.
+        float roadV = renderRace.roadOffset / windowHeight;
+        SpriteUV roadUV = { 0, roadV, 1, roadV + 1 };
+        drawSprite(textures.road, 0, 0, windowWidth, windowHeight, roadUV, roadTint(textures));
+        flushSprites();
+
+        // Every car comes from the atlas, so they all go out in one draw;
+        // the player is queued last and ends up on top.
+        const Traffic& traffic = renderRace.traffic;
+        for (size_t i = 0; i < trafficCount(traffic); i++)
+            drawSprite(textures.sprites.texture, traffic.x[i], traffic.y[i], carWidth, carHeight,
+                       textures.sprites.regions[traffic.sprite[i]], spriteTint(textures, traffic.sprite[i]));
+        drawSprite(textures.sprites.texture, renderRace.player.x, renderRace.player.y, carWidth, carHeight,
+                   textures.sprites.regions[renderRace.player.sprite], spriteTint(textures, renderRace.player.sprite));
+        flushSprites();
         drawHUD();
+        flushSprites();
 
         glutSwapBuffers();
     }
 }
 
+// Replay viewer: 0-9 jump to that tenth of the race, left/right skip 5 s.
+void seekWatchedReplay(long tick) {
+    seekReplay(replayPlayer, loadedReplay, race, static_cast<unsigned long>(max(0L, tick)));
+    previousRace = race;
+    accumulator = 0;
+}
+
 void keyDown(unsigned char key, int x, int y) {
     key = tolower(key);
     if (currentState == MENU) {
@@ -442,9 +423,13 @@ void keyDown(unsigned char key, int x, int y) {
             pauseGame();
         }
         if (key == 32) keyBrake = true;
+        if (watchingReplay && key >= '0' && key <= '9') {
+            unsigned long end = loadedReplay.complete ? loadedReplay.finalTick : race.tick;
+            seekWatchedReplay(static_cast<long>(end * (key - '0') / 10));
+        }
     } else if (currentState == GAME_OVER) {
         resetGame();
-        currentState = MENU;
+        changeState(MENU);
     }
     #ifdef _WIN32
     if (key == 'p' && currentState == GAME) {
@@ -466,7 +451,11 @@ void keyUpFunc(unsigned char key, int x, int y) {
 }
 
 void specialDown(int key, int x, int y) {
-    if (currentState == GAME) {
+    if (currentState == GAME && watchingReplay) {
+        long jump = static_cast<long>(5.0f / race.tickSeconds);
+        if (key == GLUT_KEY_LEFT) seekWatchedReplay(static_cast<long>(race.tick) - jump);
+        if (key == GLUT_KEY_RIGHT) seekWatchedReplay(static_cast<long>(race.tick) + jump);
+    } else if (currentState == GAME) {
         if (key == GLUT_KEY_UP) keyUp = true;
         if (key == GLUT_KEY_LEFT) keyLeft = true;
         if (key == GLUT_KEY_RIGHT) keyRight = true;
@@ -482,47 +471,47 @@ void specialUp(int key, int x, int y) {
 }
 
 void startGame() {
-    resetGame();
-    currentState = GAME;
+    startRequested = !texturesLoaded;
+    if (startRequested) return;
+    if (watchingReplay) {
+        startPlayback(replayPlayer, loadedReplay, race);
+        previousRace = race;
+        accumulator = 0;
+    } else {
+        race.seed = fixedSeed ? fixedSeed : static_cast<uint64_t>(time(0));
+        setDifficulty(race, selectedDifficulty);
+        resetGame();
+        beginRecording(recorder, race);
+    }
+    raceInProgress = true;
+    changeState(GAME);
 }
 
 void showScores() {
-    currentState = SCORES;
+    changeState(SCORES);
 }
 
 void selectLevel() {
-    currentState = SELECT_LEVEL;
+    changeState(SELECT_LEVEL);
 }
 
 void setEasy() {
-    currentDifficulty = EASY;
-    minSpeed = 10.0f;
-    playerSpeed = minSpeed;
-    scoreMultiplier = 1.0f;
-    aiSpawnInterval = 4.0f;
-    currentState = MENU;
+    selectedDifficulty = EASY;
+    changeState(MENU);
 }
 
 void setMedium() {
-    currentDifficulty = MEDIUM;
-    minSpeed = 20.0f;
-    playerSpeed = minSpeed;
-    scoreMultiplier = 2.0f;
-    aiSpawnInterval = 2.0f;
-    currentState = MENU;
+    selectedDifficulty = MEDIUM;
+    changeState(MENU);
 }
 
 void setHard() {
-    currentDifficulty = HARD;
-    minSpeed = 40.0f;
-    playerSpeed = minSpeed;
-    scoreMultiplier = 3.0f;
-    aiSpawnInterval = 1.0f;
-    currentState = MENU;
+    selectedDifficulty = HARD;
+    changeState(MENU);
 }
 
 void goBack() {
-    currentState = MENU;
+    changeState(MENU);
 }
 
 void exitGame() {
@@ -533,28 +522,23 @@ void exitGame() {
 }
 
 void continueGame() {
-    if (currentState == MENU && !gameOver) {
-        currentState = GAME;
+    // Behind the same readiness gate as startGame(), so Continue never
+    // draws a race while the texture workers are still decoding.
+    if (currentState == MENU && raceInProgress && texturesLoaded) {
+        changeState(GAME);
     }
 }
 
 void pauseGame() {
     if (currentState == GAME) {
-        currentState = MENU;
+        changeState(MENU);
     }
 }
 
 void resetGame() {
-    player = { 800.0f, windowHeight - carHeight - bottomMargin, minSpeed, playerTex, true, 5 };
-    aiCars.clear();
-    raceDistance = 0;
-    lap = 1;
-    playerPosition = 1;
-    gameOver = false;
-    score = 0;
-    lastAISpawnTime = 0;
-    roadOffset = 0;
-    playerSpeed = minSpeed;
+    resetRace(race);
+    previousRace = race;
+    accumulator = 0;
 }
 
 void mouseClick(int button, int state, int x, int y) {
@@ -586,21 +570,15 @@ void mouseMotion(int x, int y) {
 
     if (buttons) {
         for (auto& btn : *buttons) {
-            btn.hovered = (x >= btn.x && x <= btn.x + btn.width && y >= btn.y && y <= btn.y + btn.height);
+            bool hovered = (x >= btn.x && x <= btn.x + btn.width && y >= btn.y && y <= btn.y + btn.height);
+            if (hovered != btn.hovered) glutPostRedisplay();
+            btn.hovered = hovered;
         }
     }
-    glutPostRedisplay();
 }
 
 #ifdef _WIN32
 void cleanup() {
-    ofstream file("scores.txt", ios::app);
-    if (file.is_open()) {
-        time_t now = time(0);
-        string diff = currentDifficulty == EASY ? "Easy" : currentDifficulty == MEDIUM ? "Medium" : "Hard";
-        file << "Score: " << score << " | Difficulty: " << diff << " | Time: " << ctime(&now) << endl;
-        file.close();
-    }
     mciSendString(TEXT("stop bgm"), NULL, 0, NULL);
     mciSendString(TEXT("close bgm"), NULL, 0, NULL);
     mciSendString(TEXT("stop crash"), NULL, 0, NULL);
@@ -608,6 +586,10 @@ void cleanup() {
 }
 #endif
 
+void closeScores() {
+    closeScoreLog(scoreLog);
+}
+
 void initGame() {
     #ifdef _WIN32
     mciSendString(TEXT("open \"audio.mp3\" type mpegvideo alias bgm"), NULL, 0, NULL);
@@ -620,12 +602,14 @@ void initGame() {
     gluOrtho2D(0, windowWidth, windowHeight, 0);
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    initSprites();
 
-    roadTex = loadTexture("ROAD.png");
-    playerTex = loadTexture("PLAYER.png");
-    car1Tex = loadTexture("CAR1.png");
-    car2Tex = loadTexture("CAR2.png");
-    car3Tex = loadTexture("CAR3.png");
+    // Decoding runs on the workers and update() uploads whatever is ready,
+    // so the menu shows up straight away. The road is stretched across the
+    // whole screen, so it keeps a texture of its own next to the car atlas.
+    startTextureLoading(textures, max(1, static_cast<int>(thread::hardware_concurrency())));
+    openScoreLog(scoreLog, scoreLogFile, legacyScoreFile, scores);
+    atexit(closeScores);
 
     float btnWidth = 400, btnHeight = 100, btnSpacing = 50;
     float totalHeight = 5 * btnHeight + 4 * btnSpacing;
@@ -647,16 +631,32 @@ void initGame() {
     scoreButtons.clear();
     scoreButtons.push_back({ (windowWidth - btnWidth) / 2, windowHeight - btnHeight - 50, btnWidth, btnHeight, "Back", false, goBack });
 
+    race.logCollisions = true;
+    setTickRate(race, simRate);
     setMedium();
+    resetGame();
 }
 
 int main(int argc, char** argv) {
+    int headlessResult = runHeadless(argc, argv);
+    if (headlessResult >= 0) return headlessResult;
+
     glutInit(&argc, argv);
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg.compare(0, 9, "--sim-hz=") == 0) simRate = max(1.0f, static_cast<float>(atof(arg.c_str() + 9)));
+        else if (arg.compare(0, 6, "--fps=") == 0) frameRate = max(1.0f, static_cast<float>(atof(arg.c_str() + 6)));
+        else if (arg.compare(0, 7, "--seed=") == 0) fixedSeed = strtoull(arg.c_str() + 7, nullptr, 10);
+        else if (arg.compare(0, 9, "--replay=") == 0) watchingReplay = loadReplay(arg.c_str() + 9, loadedReplay);
+    }
+
     glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE);
     glutInitWindowSize(windowWidth, windowHeight);
     glutCreateWindow("2D Racing Game - OpenGL/GLUT");
+    windowOpenedTime = elapsedSeconds();
 
     initGame();
+    if (watchingReplay) startGame();
 
     #ifdef _WIN32
     atexit(cleanup);
@@ -670,7 +670,7 @@ int main(int argc, char** argv) {
     glutMouseFunc(mouseClick);
     glutMotionFunc(mouseMotion);
     glutPassiveMotionFunc(mouseMotion);
-    glutTimerFunc(16, update, 0);
+    wakeUpdates();
 
     glutMainLoop();
     return 0;
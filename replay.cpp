@@ -0,0 +1,276 @@
+#include "replay.h"
+#include "bytes.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+
+using namespace std;
+
+static const char replayMagic[4] = { 'R', 'P', 'L', 'Y' };
+static const char indexMagic[4] = { 'R', 'I', 'D', 'X' };
+static const uint8_t replayVersion = 4;
+static const size_t replayHeaderSizeV1 = 4 + 1 + 1 + 4 + 8;
+static const size_t replayHeaderSizeV2 = replayHeaderSizeV1 + 4;
+static const size_t replayHeaderSize = replayHeaderSizeV2 + 4 + 1 + 4;
+static const size_t footerSize = 8 + 4;
+static const uint8_t indexRecord = 0xFD;
+static const uint8_t keyframeRecord = 0xFE;
+static const uint8_t endRecord = 0xFF;
+
+static uint8_t packInput(const RaceInput& input) {
+    return (input.up ? 1 : 0) | (input.left ? 2 : 0) | (input.right ? 4 : 0) | (input.brake ? 8 : 0);
+}
+
+static RaceInput unpackInput(uint8_t bits) {
+    RaceInput input = { (bits & 1) != 0, (bits & 2) != 0, (bits & 4) != 0, (bits & 8) != 0 };
+    return input;
+}
+
+static void flushRun(ReplayRecorder& recorder) {
+    if (recorder.runLength == 0) return;
+    recorder.data.push_back(recorder.runInput);
+    putVarint(recorder.data, recorder.runLength);
+    recorder.runLength = 0;
+}
+
+void beginRecording(ReplayRecorder& recorder, const RaceState& race, unsigned long keyframeInterval) {
+    recorder.data.clear();
+    for (char c : replayMagic) recorder.data.push_back(static_cast<uint8_t>(c));
+    recorder.data.push_back(replayVersion);
+    recorder.data.push_back(static_cast<uint8_t>(race.difficulty));
+    putFloat(recorder.data, race.tickSeconds);
+    putU64(recorder.data, race.seed);
+    putU32(recorder.data, static_cast<uint32_t>(keyframeInterval));
+    putU32(recorder.data, static_cast<uint32_t>(race.maxTraffic));
+    recorder.data.push_back(race.endless ? 1 : 0);
+    putFloat(recorder.data, race.aiSpawnInterval);
+    recorder.runInput = 0;
+    recorder.runLength = 0;
+    recorder.keyframeInterval = keyframeInterval;
+    recorder.keyframes.clear();
+}
+
+void recordInput(ReplayRecorder& recorder, const RaceState& race, const RaceInput& input) {
+    if (recorder.keyframeInterval > 0 && race.tick % recorder.keyframeInterval == 0) {
+        flushRun(recorder);
+        vector<uint8_t> snapshot;
+        writeRaceState(snapshot, race);
+        recorder.keyframes.push_back(recorder.data.size());
+        recorder.data.push_back(keyframeRecord);
+        putVarint(recorder.data, race.tick);
+        putVarint(recorder.data, snapshot.size());
+        recorder.data.insert(recorder.data.end(), snapshot.begin(), snapshot.end());
+    }
+
+    uint8_t bits = packInput(input);
+    if (recorder.runLength > 0 && bits != recorder.runInput) flushRun(recorder);
+    recorder.runInput = bits;
+    recorder.runLength++;
+}
+
+void finishRecording(ReplayRecorder& recorder, const RaceState& race) {
+    flushRun(recorder);
+    recorder.data.push_back(endRecord);
+    putVarint(recorder.data, race.tick);
+    putVarint(recorder.data, static_cast<uint64_t>(race.score));
+
+    uint64_t indexOffset = recorder.data.size();
+    recorder.data.push_back(indexRecord);
+    putVarint(recorder.data, race.tick);
+    putVarint(recorder.data, static_cast<uint64_t>(race.score));
+    putVarint(recorder.data, recorder.keyframeInterval);
+    putVarint(recorder.data, recorder.keyframes.size());
+    for (uint64_t offset : recorder.keyframes) putU64(recorder.data, offset);
+    putU64(recorder.data, indexOffset);
+    for (char c : indexMagic) recorder.data.push_back(static_cast<uint8_t>(c));
+}
+
+bool saveReplay(const ReplayRecorder& recorder, const char* filename) {
+    ofstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        cerr << "Failed to write replay: " << filename << endl;
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(recorder.data.data()), recorder.data.size());
+    return file.good();
+}
+
+// Reads the index named by the footer. Fails quietly so the caller can fall
+// back to scanning a file that was cut off before it was finished.
+static bool readIndex(Replay& replay) {
+    const vector<uint8_t>& data = replay.data;
+    if (data.size() < replay.inputStart + footerSize) return false;
+    const uint8_t* footer = &data[data.size() - footerSize];
+    if (memcmp(footer + 8, indexMagic, 4) != 0) return false;
+    uint64_t indexOffset = getU64(footer);
+    if (indexOffset < replay.inputStart || indexOffset >= data.size() - footerSize || data[indexOffset] != indexRecord) return false;
+
+    size_t pos = static_cast<size_t>(indexOffset) + 1;
+    size_t end = data.size() - footerSize;
+    uint64_t finalTick, finalScore, interval, count;
+    if (!getVarint(data.data(), end, pos, finalTick) || !getVarint(data.data(), end, pos, finalScore) ||
+        !getVarint(data.data(), end, pos, interval) || !getVarint(data.data(), end, pos, count))
+        return false;
+    if (count > (end - pos) / 8) return false;
+
+    replay.keyframes.resize(static_cast<size_t>(count));
+    for (auto& offset : replay.keyframes) {
+        offset = getU64(&data[pos]);
+        if (offset >= indexOffset || data[offset] != keyframeRecord) return false;
+        pos += 8;
+    }
+    replay.finalTick = static_cast<unsigned long>(finalTick);
+    replay.finalScore = static_cast<int>(finalScore);
+    replay.keyframeInterval = static_cast<unsigned long>(interval);
+    replay.complete = true;
+    return true;
+}
+
+bool loadReplay(const char* filename, Replay& replay) {
+    ifstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        cerr << "Failed to open replay: " << filename << endl;
+        return false;
+    }
+    replay.data.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+
+    const vector<uint8_t>& data = replay.data;
+    if (data.size() < replayHeaderSizeV1 || memcmp(data.data(), replayMagic, 4) != 0 ||
+        data[4] < 1 || data[4] > replayVersion || data[5] > HARD) {
+        cerr << "Not a replay file: " << filename << endl;
+        return false;
+    }
+    uint8_t version = data[4];
+    replay.version = version;
+    replay.difficulty = static_cast<Difficulty>(data[5]);
+    replay.tickSeconds = getFloat(&data[6]);
+    replay.seed = getU64(&data[10]);
+    replay.inputStart = replayHeaderSizeV1;
+    replay.keyframeInterval = 0;
+    // Older replays were all plain races with the difficulty's own settings.
+    RaceState defaults;
+    setDifficulty(defaults, replay.difficulty);
+    replay.maxTraffic = 0;
+    replay.endless = false;
+    replay.aiSpawnInterval = defaults.aiSpawnInterval;
+    if (version >= 2) {
+        if (data.size() < (version >= 3 ? replayHeaderSize : replayHeaderSizeV2)) {
+            cerr << "Not a replay file: " << filename << endl;
+            return false;
+        }
+        replay.keyframeInterval = getU32(&data[18]);
+        replay.inputStart = replayHeaderSizeV2;
+    }
+    if (version >= 3) {
+        replay.maxTraffic = static_cast<int>(getU32(&data[22]));
+        replay.endless = data[26] != 0;
+        replay.aiSpawnInterval = getFloat(&data[27]);
+        replay.inputStart = replayHeaderSize;
+    }
+    replay.finalTick = 0;
+    replay.finalScore = 0;
+    replay.complete = false;
+    replay.keyframes.clear();
+
+    if (version >= 2 && readIndex(replay)) return true;
+
+    // No usable index: walk the records, which also reports a truncated file
+    // up front and rebuilds the keyframe list from what is there.
+    replay.keyframes.clear();
+    size_t pos = replay.inputStart;
+    while (pos < data.size()) {
+        size_t recordStart = pos;
+        uint8_t tag = data[pos++];
+        uint64_t a, b;
+        if (tag == endRecord) {
+            if (!getVarint(data, pos, a) || !getVarint(data, pos, b)) break;
+            replay.finalTick = static_cast<unsigned long>(a);
+            replay.finalScore = static_cast<int>(b);
+            replay.complete = true;
+            break;
+        }
+        if (tag == keyframeRecord) {
+            if (!getVarint(data, pos, a) || !getVarint(data, pos, b) || b > data.size() - pos) break;
+            replay.keyframes.push_back(recordStart);
+            pos += static_cast<size_t>(b);
+            continue;
+        }
+        if (tag > 0x0F || !getVarint(data, pos, a)) {
+            cerr << "Corrupt replay record at offset " << recordStart << " in " << filename << endl;
+            return false;
+        }
+    }
+    if (!replay.complete) cerr << "Replay has no end record, playing what is there: " << filename << endl;
+    return true;
+}
+
+void startPlayback(ReplayPlayer& player, const Replay& replay, RaceState& race) {
+    player.replay = &replay;
+    player.pos = replay.inputStart;
+    player.runInput = 0;
+    player.runLength = 0;
+
+    setDifficulty(race, replay.difficulty);
+    race.seed = replay.seed;
+    race.tickSeconds = replay.tickSeconds;
+    race.maxTraffic = replay.maxTraffic;
+    race.endless = replay.endless;
+    race.aiSpawnInterval = replay.aiSpawnInterval;
+    resetRace(race);
+}
+
+// Moves pos from a keyframe's tag byte to the record after it.
+static bool skipKeyframe(const vector<uint8_t>& data, size_t& pos, size_t& payload, size_t& payloadSize) {
+    pos++;
+    uint64_t tick, size;
+    if (!getVarint(data, pos, tick) || !getVarint(data, pos, size) || size > data.size() - pos) return false;
+    payload = pos;
+    payloadSize = static_cast<size_t>(size);
+    pos += payloadSize;
+    return true;
+}
+
+bool nextReplayInput(ReplayPlayer& player, RaceInput& input) {
+    const vector<uint8_t>& data = player.replay->data;
+    while (player.runLength == 0) {
+        if (player.pos >= data.size()) return false;
+        if (data[player.pos] == keyframeRecord) {
+            size_t payload, payloadSize;
+            if (!skipKeyframe(data, player.pos, payload, payloadSize)) return false;
+            continue;
+        }
+        if (data[player.pos] > 0x0F) return false;
+        player.runInput = data[player.pos++];
+        uint64_t length;
+        if (!getVarint(data, player.pos, length)) return false;
+        player.runLength = static_cast<uint32_t>(length);
+    }
+    player.runLength--;
+    input = unpackInput(player.runInput);
+    return true;
+}
+
+bool seekReplay(ReplayPlayer& player, const Replay& replay, RaceState& race, unsigned long tick) {
+    bool restored = false;
+    if (!replay.keyframes.empty() && replay.keyframeInterval > 0) {
+        size_t k = tick / replay.keyframeInterval;
+        if (k >= replay.keyframes.size()) k = replay.keyframes.size() - 1;
+        size_t pos = static_cast<size_t>(replay.keyframes[k]);
+        size_t payload, payloadSize;
+        if (skipKeyframe(replay.data, pos, payload, payloadSize) &&
+            readRaceState(&replay.data[payload], payloadSize, race, replay.version >= 4 ? raceStateVersion : 1)) {
+            player.replay = &replay;
+            player.pos = pos;
+            player.runInput = 0;
+            player.runLength = 0;
+            restored = true;
+        }
+    }
+    if (!restored) startPlayback(player, replay, race);
+
+    RaceInput input;
+    while (race.tick < tick && !race.gameOver && nextReplayInput(player, input))
+        stepRace(race, input);
+    return race.tick == tick;
+}
@@ -0,0 +1,73 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+#include "sim.h"
+
+// A replay is the race seed and settings (including the traffic limit,
+// spawn interval and endless flag of a stress run) followed by the
+// per-tick inputs, stored as runs: one byte holding the four input bits
+// and a varint run length. The stream ends with a record holding the final tick and score so
+// playback can check it reproduced the race.
+//
+// Every keyframeInterval ticks the recorder also writes a full RaceState
+// snapshot. An index of snapshot offsets follows the end record and a fixed
+// size footer points at it, so a viewer can restore the nearest snapshot and
+// simulate at most one interval forward instead of replaying from tick 0.
+
+const unsigned long defaultKeyframeInterval = 600;
+
+struct ReplayRecorder {
+    std::vector<uint8_t> data;
+    uint8_t runInput;
+    uint32_t runLength;
+    unsigned long keyframeInterval;
+    std::vector<uint64_t> keyframes;
+};
+
+void beginRecording(ReplayRecorder& recorder, const RaceState& race, unsigned long keyframeInterval = defaultKeyframeInterval);
+// Call once per tick with the state about to be stepped.
+void recordInput(ReplayRecorder& recorder, const RaceState& race, const RaceInput& input);
+void finishRecording(ReplayRecorder& recorder, const RaceState& race);
+bool saveReplay(const ReplayRecorder& recorder, const char* filename);
+
+struct Replay {
+    uint8_t version;   // of the file; version 4 keyframes hold stress-run settings
+    uint64_t seed;
+    Difficulty difficulty;
+    float tickSeconds;
+    // Stress-run settings from the header; a plain race has 0, false and
+    // the difficulty's spawn interval.
+    int maxTraffic;
+    bool endless;
+    float aiSpawnInterval;
+    unsigned long finalTick;
+    int finalScore;
+    bool complete;
+    std::vector<uint8_t> data;
+    size_t inputStart;
+    unsigned long keyframeInterval;
+    std::vector<uint64_t> keyframes;
+};
+
+bool loadReplay(const char* filename, Replay& replay);
+
+struct ReplayPlayer {
+    const Replay* replay;
+    size_t pos;
+    uint8_t runInput;
+    uint32_t runLength;
+};
+
+// Sets race up from the replay header and rewinds the player.
+void startPlayback(ReplayPlayer& player, const Replay& replay, RaceState& race);
+// Fetches the input for the next tick; false once the recording runs out.
+bool nextReplayInput(ReplayPlayer& player, RaceInput& input);
+// Puts race at the given tick (or the last one recorded) by restoring the
+// closest earlier keyframe and stepping forward from it.
+bool seekReplay(ReplayPlayer& player, const Replay& replay, RaceState& race, unsigned long tick);
+
+#endif
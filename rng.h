@@ -0,0 +1,58 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+// xoshiro128** generator. Each race and each traffic car owns one, so runs
+// are reproducible from the race seed and never share libc's rand() state.
+struct Rng {
+    uint32_t s[4];
+};
+
+inline uint64_t splitMix64(uint64_t& x) {
+    uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Different stream numbers give unrelated sequences from the same seed.
+inline void seedRng(Rng& rng, uint64_t seed, uint64_t stream) {
+    uint64_t x = seed ^ (stream * 0xD1B54A32D192ED03ull);
+    uint64_t a = splitMix64(x);
+    uint64_t b = splitMix64(x);
+    rng.s[0] = static_cast<uint32_t>(a);
+    rng.s[1] = static_cast<uint32_t>(a >> 32);
+    rng.s[2] = static_cast<uint32_t>(b);
+    rng.s[3] = static_cast<uint32_t>(b >> 32);
+    if ((rng.s[0] | rng.s[1] | rng.s[2] | rng.s[3]) == 0) rng.s[0] = 1;
+}
+
+inline uint32_t rotl32(uint32_t x, int k) {
+    return (x << k) | (x >> (32 - k));
+}
+
+inline uint32_t nextRandom(Rng& rng) {
+    uint32_t* s = rng.s;
+    uint32_t result = rotl32(s[1] * 5, 7) * 9;
+    uint32_t t = s[1] << 9;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl32(s[3], 11);
+    return result;
+}
+
+// Uniform in [0, 1).
+inline float randomFloat(Rng& rng) {
+    return (nextRandom(rng) >> 8) * (1.0f / 16777216.0f);
+}
+
+// Uniform in [0, n).
+inline int randomInt(Rng& rng, int n) {
+    return static_cast<int>((static_cast<uint64_t>(nextRandom(rng)) * static_cast<uint32_t>(n)) >> 32);
+}
+
+#endif
@@ -0,0 +1,326 @@
+#include "scorelog.h"
+#include "bytes.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <chrono>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const char logMagic[4] = { 'R', 'C', 'S', 'L' };
+static const uint32_t logVersion = 1;
+static const size_t logHeaderSize = 8;
+static const size_t scoreRecordSize = 20;
+// The log is rewritten once it holds this many times what it would keep.
+static const size_t compactFactor = 2;
+// The writer looks at the queue this often even if no wake-up reaches it.
+static const chrono::milliseconds writerPoll(100);
+
+typedef chrono::steady_clock Clock;
+
+static int64_t clockNanos() {
+    return chrono::duration_cast<chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+static void putHeader(vector<uint8_t>& out) {
+    for (char c : logMagic) out.push_back(static_cast<uint8_t>(c));
+    putU32(out, logVersion);
+}
+
+static void putRecord(vector<uint8_t>& out, const ScoreRecord& record) {
+    size_t start = out.size();
+    putU32(out, static_cast<uint32_t>(record.score));
+    putU32(out, static_cast<uint32_t>(record.difficulty));
+    putU64(out, static_cast<uint64_t>(record.time));
+    putU32(out, crc32(&out[start], scoreRecordSize - 4));
+}
+
+static bool getRecord(const uint8_t* p, ScoreRecord& record) {
+    uint32_t difficulty = getU32(p + 4);
+    if (getU32(p + scoreRecordSize - 4) != crc32(p, scoreRecordSize - 4) || difficulty > HARD) return false;
+    record.score = static_cast<int32_t>(getU32(p));
+    record.difficulty = static_cast<Difficulty>(difficulty);
+    record.time = static_cast<int64_t>(getU64(p + 8));
+    return true;
+}
+
+static bool syncFile(FILE* file) {
+    if (fflush(file) != 0) return false;
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+static bool appendBytes(FILE* file, const vector<uint8_t>& bytes) {
+    return fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size() && syncFile(file);
+}
+
+static bool replaceFile(const string& temp, const string& filename) {
+#ifdef _WIN32
+    return MoveFileExA(temp.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(temp.c_str(), filename.c_str()) == 0;
+#endif
+}
+
+static bool truncateFile(const string& filename, size_t size) {
+#ifdef _WIN32
+    int fd = _open(filename.c_str(), _O_RDWR | _O_BINARY);
+    if (fd < 0) return false;
+    bool ok = _chsize(fd, static_cast<long>(size)) == 0;
+    _close(fd);
+    return ok;
+#else
+    return truncate(filename.c_str(), static_cast<off_t>(size)) == 0;
+#endif
+}
+
+// A complete, synced log holding records, under a temporary name; the
+// caller renames it into place, so a crash leaves the old log or the new
+// one and never half of either.
+static bool writeScoreFile(const string& temp, const vector<ScoreRecord>& records) {
+    vector<uint8_t> bytes;
+    putHeader(bytes);
+    for (const ScoreRecord& record : records) putRecord(bytes, record);
+    FILE* file = fopen(temp.c_str(), "wb");
+    if (!file) return false;
+    bool ok = appendBytes(file, bytes);
+    ok = fclose(file) == 0 && ok;
+    if (!ok) remove(temp.c_str());
+    return ok;
+}
+
+// repair trims a torn record off the end; otherwise the file is only read.
+static bool readScoreLog(const string& filename, vector<ScoreRecord>& records, size_t& wholeRecords, bool repair) {
+    ifstream file(filename.c_str(), ios::binary);
+    records.clear();
+    wholeRecords = 0;
+    // No log yet is just an empty history.
+    if (!file) return true;
+    vector<uint8_t> data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    if (data.size() < logHeaderSize || memcmp(data.data(), logMagic, 4) != 0 || getU32(&data[4]) != logVersion) {
+        cerr << "Not a score log, leaving it alone: " << filename << endl;
+        return false;
+    }
+
+    wholeRecords = (data.size() - logHeaderSize) / scoreRecordSize;
+    size_t damaged = 0;
+    records.reserve(wholeRecords);
+    for (size_t i = 0; i < wholeRecords; i++) {
+        ScoreRecord record;
+        if (getRecord(&data[logHeaderSize + i * scoreRecordSize], record)) records.push_back(record);
+        else damaged++;
+    }
+    if (damaged) cerr << "Skipped " << damaged << " damaged records in " << filename << endl;
+
+    // A crash part way through an append leaves a partial record at the
+    // end; cut it off so the next one lands on a record boundary.
+    size_t end = logHeaderSize + wholeRecords * scoreRecordSize;
+    if (repair && end != data.size() && !truncateFile(filename, end)) {
+        cerr << "Failed to trim a torn record off " << filename << endl;
+        return false;
+    }
+    return true;
+}
+
+static bool needsCompaction(const ScoreLog& log) {
+    return log.records > compactFactor * scoreKeepPerDifficulty * (HARD + 1);
+}
+
+// Rewrites the log with the best scoreKeepPerDifficulty races of each
+// difficulty, in the order they were run. Nothing else writes to the file
+// meanwhile: races finished during it just wait in the queue.
+static void compactScoreLog(ScoreLog& log) {
+    ScoreTable table;
+    size_t wholeRecords = 0;
+    if (!readScoreLog(log.filename, table.records, wholeRecords, true)) return;
+    // Only the rankings decide what is kept.
+    rankScores(table, false);
+    vector<uint32_t> keep;
+    for (const ScoreIndex& index : table.byDifficulty) {
+        vector<uint32_t> best = topScores(index, scoreKeepPerDifficulty);
+        keep.insert(keep.end(), best.begin(), best.end());
+    }
+    sort(keep.begin(), keep.end());
+    vector<ScoreRecord> kept;
+    kept.reserve(keep.size());
+    for (uint32_t i : keep) kept.push_back(table.records[i]);
+
+    string temp = log.filename + ".compact";
+    if (!writeScoreFile(temp, kept)) {
+        cerr << "Failed to compact " << log.filename << endl;
+        return;
+    }
+    // The old log is closed first: Windows will not replace an open file.
+    fclose(log.file);
+    bool ok = replaceFile(temp, log.filename);
+    log.file = fopen(log.filename.c_str(), "ab");
+    if (!log.file) cerr << "Failed to reopen score log, later races will not be saved: " << log.filename << endl;
+    if (!ok) {
+        cerr << "Failed to compact " << log.filename << endl;
+        remove(temp.c_str());
+        return;
+    }
+    cout << "Compacted " << log.filename << ": " << log.records << " records down to " << kept.size() << endl;
+    log.records = kept.size();
+}
+
+// Appends everything queued so far as one write and one fsync. The slots
+// are only handed back once the records are on disk.
+static void writeQueued(ScoreLog& log) {
+    size_t head = log.head.load(memory_order_relaxed);
+    size_t tail = log.tail.load(memory_order_acquire);
+    if (head == tail) return;
+
+    size_t count = tail - head;
+    if (!log.file) {
+        // Already reported when the file was lost; these races are only
+        // in the table now.
+        log.dropped += count;
+        log.head.store(tail, memory_order_release);
+        return;
+    }
+
+    int64_t start = clockNanos();
+    vector<uint8_t> bytes;
+    for (size_t i = head; i != tail; i++) putRecord(bytes, log.queue[i % scoreQueueDepth].record);
+    if (!appendBytes(log.file, bytes)) {
+        // Later records would land off the record grid; stop here and let
+        // the next open trim whatever part of these reached the disk.
+        cerr << "Failed to write score log, later races will not be saved: " << log.filename << endl;
+        fclose(log.file);
+        log.file = nullptr;
+        log.dropped += count;
+        log.head.store(tail, memory_order_release);
+        return;
+    }
+    int64_t end = clockNanos();
+
+    for (size_t i = head; i != tail; i++) {
+        double waitMs = (start - log.queue[i % scoreQueueDepth].postedAt) / 1e6;
+        log.totalWaitMs += waitMs;
+        log.maxWaitMs = max(log.maxWaitMs, waitMs);
+    }
+    double writeMs = (end - start) / 1e6;
+    log.totalWriteMs += writeMs * count;
+    log.maxWriteMs = max(log.maxWriteMs, writeMs);
+    log.written += count;
+    log.writes++;
+    log.records += count;
+    log.head.store(tail, memory_order_release);
+
+    if (needsCompaction(log)) compactScoreLog(log);
+}
+
+static void writerLoop(ScoreLog* log) {
+    while (true) {
+        // Checked before draining, so whatever was posted before the stop
+        // still gets written.
+        bool stopping = log->stopping;
+        writeQueued(*log);
+        if (stopping) break;
+        unique_lock<mutex> lock(log->wakeMutex);
+        log->wake.wait_for(lock, writerPoll, [log] {
+            return log->stopping || log->head.load(memory_order_relaxed) != log->tail.load(memory_order_acquire);
+        });
+    }
+}
+
+bool openScoreLog(ScoreLog& log, const char* filename, const char* legacyFile, ScoreTable& table) {
+    log.filename = filename;
+    log.records = 0;
+    table.records.clear();
+
+    if (FILE* existing = fopen(filename, "rb")) {
+        fclose(existing);
+        bool ok = readScoreLog(log.filename, table.records, log.records, true);
+        rankScores(table);
+        if (!ok) return false;
+    } else {
+        // First run with a log: bring the old text history across.
+        ifstream legacy(legacyFile);
+        readScoreText(table, legacy);
+        string temp = log.filename + ".tmp";
+        if (!writeScoreFile(temp, table.records) || !replaceFile(temp, log.filename)) {
+            cerr << "Failed to create score log: " << filename << endl;
+            remove(temp.c_str());
+            return false;
+        }
+        log.records = table.records.size();
+        if (!table.records.empty())
+            cout << "Imported " << table.records.size() << " scores from " << legacyFile << " into " << filename << endl;
+    }
+
+    log.file = fopen(filename, "ab");
+    if (!log.file) {
+        cerr << "Failed to open score log: " << filename << endl;
+        return false;
+    }
+    log.stopping = false;
+    log.writer = thread(writerLoop, &log);
+    return true;
+}
+
+bool loadScoreLog(ScoreTable& table, const char* filename) {
+    FILE* existing = fopen(filename, "rb");
+    if (!existing) {
+        cerr << "Failed to open score log: " << filename << endl;
+        return false;
+    }
+    fclose(existing);
+    size_t wholeRecords = 0;
+    bool ok = readScoreLog(filename, table.records, wholeRecords, false);
+    rankScores(table);
+    return ok;
+}
+
+void recordScore(ScoreLog& log, ScoreTable& table, const ScoreRecord& record) {
+    addScore(table, record);
+    if (!log.writer.joinable()) return;
+
+    size_t tail = log.tail.load(memory_order_relaxed);
+    if (tail - log.head.load(memory_order_acquire) == scoreQueueDepth) {
+        // A whole queue of races behind the disk: nothing to do but wait.
+        log.fullStalls++;
+        log.wake.notify_one();
+        while (tail - log.head.load(memory_order_acquire) == scoreQueueDepth) this_thread::yield();
+    }
+    log.queue[tail % scoreQueueDepth] = { record, clockNanos() };
+    log.tail.store(tail + 1, memory_order_release);
+    log.deepestQueue = max(log.deepestQueue, tail + 1 - log.head.load(memory_order_relaxed));
+    log.wake.notify_one();
+}
+
+void closeScoreLog(ScoreLog& log) {
+    if (log.writer.joinable()) {
+        {
+            // Under the lock so the stop cannot slip in between the
+            // writer checking for work and going to sleep.
+            lock_guard<mutex> lock(log.wakeMutex);
+            log.stopping = true;
+        }
+        log.wake.notify_one();
+        log.writer.join();
+        if (log.written)
+            cout << "Score log: " << log.written << " races in " << log.writes << " writes, queue wait avg "
+                 << log.totalWaitMs / log.written << " ms max " << log.maxWaitMs << " ms, write avg "
+                 << log.totalWriteMs / log.written << " ms max " << log.maxWriteMs << " ms, deepest queue "
+                 << log.deepestQueue << ", full " << log.fullStalls << " times" << endl;
+        if (log.dropped) cerr << "Score log: " << log.dropped << " races were not saved" << endl;
+    }
+    if (!log.file) return;
+    fclose(log.file);
+    log.file = nullptr;
+}
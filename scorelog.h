@@ -0,0 +1,77 @@
+#ifndef SCORELOG_H
+#define SCORELOG_H
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdio>
+
+#include "scores.h"
+
+// Score history on disk, append-only. Every finished race is written as
+// one fixed-size record carrying its own checksum, so a write torn by a
+// crash or a damaged sector costs that record and nothing else.
+//
+// File layout, little-endian: "RCSL", u32 version, then 20-byte records:
+// i32 score, u32 difficulty, i64 time, u32 CRC-32 of the first 16 bytes.
+//
+// The file is only touched by a writer thread of its own, so a slow disk
+// never holds up a frame. The game thread hands it races through a
+// fixed-size lock-free queue; the writer appends whatever is queued in
+// one write and one fsync. Once the log holds well over
+// scoreKeepPerDifficulty records per difficulty the writer rewrites it
+// with just the best that many of each.
+
+// The game's history, and the text file older versions wrote instead.
+const char* const scoreLogFile = "scores.dat";
+const char* const legacyScoreFile = "scores.txt";
+
+const size_t scoreQueueDepth = 64;
+const size_t scoreKeepPerDifficulty = 10000;
+
+struct QueuedScore {
+    ScoreRecord record;
+    int64_t postedAt;   // steady clock, nanoseconds
+};
+
+struct ScoreLog {
+    std::string filename;
+    FILE* file = nullptr;   // writer thread only, once it is running
+    size_t records = 0;     // whole records in the file
+
+    // Single producer (the game thread), single consumer (the writer).
+    // head and tail only ever grow; slots are taken modulo the depth.
+    QueuedScore queue[scoreQueueDepth];
+    std::atomic<size_t> head{0}, tail{0};
+    std::atomic<bool> stopping{false};
+    std::thread writer;
+    // Only for the writer to sleep on; posting never takes the lock.
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+
+    // Written by the writer, read once it has stopped.
+    size_t written = 0, writes = 0;
+    size_t dropped = 0;   // never reached the file
+    double totalWaitMs = 0, maxWaitMs = 0;    // posted until picked up
+    double totalWriteMs = 0, maxWriteMs = 0;  // picked up until synced
+    // Game thread only.
+    size_t deepestQueue = 0, fullStalls = 0;
+};
+
+// Loads every intact record into table, opens the log for appending and
+// starts its writer. Without a log, the races in the old text history
+// legacyFile (if any) are imported into a new one first.
+bool openScoreLog(ScoreLog& log, const char* filename, const char* legacyFile, ScoreTable& table);
+// Loads every intact record into table without changing the file or
+// starting a writer, for tools that only read the history. A missing file
+// is an error here.
+bool loadScoreLog(ScoreTable& table, const char* filename);
+// Files a finished race in the table and queues it for the writer. Only
+// waits if scoreQueueDepth races are already waiting for the disk.
+void recordScore(ScoreLog& log, ScoreTable& table, const ScoreRecord& record);
+// Writes out everything still queued, stops the writer and closes.
+void closeScoreLog(ScoreLog& log);
+
+#endif
@@ -0,0 +1,274 @@
+#include "scores.h"
+
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <ctime>
+
+using namespace std;
+
+static const char* monthNames[12] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+const char* difficultyName(Difficulty difficulty) {
+    return difficulty == EASY ? "Easy" : difficulty == MEDIUM ? "Medium" : "Hard";
+}
+
+// Steps through one history line; a step that does not match clears ok
+// and every later step does nothing.
+struct LineReader {
+    const char* at;
+    bool ok;
+
+    void expect(const char* text) {
+        size_t length = strlen(text);
+        if (ok && strncmp(at, text, length) == 0) at += length;
+        else ok = false;
+    }
+
+    int number() {
+        while (ok && *at == ' ') at++;
+        const char* start = at;
+        long value = ok ? strtol(start, const_cast<char**>(&at), 10) : 0;
+        ok = ok && at != start;
+        return static_cast<int>(value);
+    }
+
+    // Letters up to the next space or end of line.
+    string word() {
+        const char* start = at;
+        while (ok && isalpha(static_cast<unsigned char>(*at))) at++;
+        ok = ok && at != start;
+        return string(start, at);
+    }
+};
+
+static int64_t localSeconds(int year, int month, int day, int hour, int minute, int second) {
+    tm when = {};
+    when.tm_year = year - 1900;
+    when.tm_mon = month;
+    when.tm_mday = day;
+    when.tm_hour = hour;
+    when.tm_min = minute;
+    when.tm_sec = second;
+    when.tm_isdst = -1;
+    return static_cast<int64_t>(mktime(&when));
+}
+
+// Hand-rolled rather than sscanf(), which was half the time it takes to
+// load a long history.
+bool parseScoreLine(const string& line, ScoreRecord& record) {
+    LineReader in = { line.c_str(), true };
+    in.expect("Score: ");
+    int score = in.number();
+    in.expect(" | Difficulty: ");
+    string difficulty = in.word();
+    in.expect(" | Time: ");
+    in.word();
+    in.expect(" ");
+    string month = in.word();
+    int day = in.number();
+    int hour = in.number();
+    in.expect(":");
+    int minute = in.number();
+    in.expect(":");
+    int second = in.number();
+    int year = in.number();
+    if (!in.ok) return false;
+
+    if (difficulty == "Easy") record.difficulty = EASY;
+    else if (difficulty == "Medium") record.difficulty = MEDIUM;
+    else if (difficulty == "Hard") record.difficulty = HARD;
+    else return false;
+
+    int monthIndex = -1;
+    for (int m = 0; m < 12; m++)
+        if (month == monthNames[m]) monthIndex = m;
+    if (monthIndex < 0) return false;
+
+    // mktime() is slow and histories are written in order, so it is asked
+    // about each day once. Days with a daylight saving change are not 24
+    // hours long and go through mktime() line by line.
+    thread_local int lastYear = -1, lastMonth = -1, lastDay = -1;
+    thread_local int64_t dayStart = 0;
+    thread_local bool regularDay = false;
+    if (year != lastYear || monthIndex != lastMonth || day != lastDay) {
+        dayStart = localSeconds(year, monthIndex, day, 0, 0, 0);
+        regularDay = localSeconds(year, monthIndex, day + 1, 0, 0, 0) - dayStart == 24 * 3600;
+        lastYear = year;
+        lastMonth = monthIndex;
+        lastDay = day;
+    }
+    int64_t time = regularDay ? dayStart + hour * 3600 + minute * 60 + second
+                              : localSeconds(year, monthIndex, day, hour, minute, second);
+    record.score = score;
+    record.time = time;
+    return true;
+}
+
+// localtime() and gmtime() share one static buffer, and the score log's
+// writer thread ranks tables while the GL thread draws dates.
+static bool splitTime(int64_t seconds, bool local, tm& out) {
+    time_t when = static_cast<time_t>(seconds);
+#ifdef _WIN32
+    return (local ? localtime_s(&out, &when) : gmtime_s(&out, &when)) == 0;
+#else
+    return (local ? localtime_r(&when, &out) : gmtime_r(&when, &out)) != nullptr;
+#endif
+}
+
+static string formatTime(int64_t seconds, bool local, const char* format) {
+    tm when;
+    char stamp[32] = "";
+    if (splitTime(seconds, local, when)) strftime(stamp, sizeof(stamp), format, &when);
+    return stamp;
+}
+
+static string formatLocalTime(int64_t seconds, const char* format) {
+    return formatTime(seconds, true, format);
+}
+
+string formatScoreLine(const ScoreRecord& record) {
+    return "Score: " + to_string(record.score) + " | Difficulty: " + difficultyName(record.difficulty) +
+           " | Time: " + formatLocalTime(record.time, "%a %b %d %H:%M:%S %Y");
+}
+
+string formatScoreDate(const ScoreRecord& record) {
+    return formatLocalTime(record.time, "%a %b %d %Y");
+}
+
+// Best first; equal scores in the order they were set, which is also
+// index order.
+static bool rankedBefore(const ScoreTable& table, uint32_t a, uint32_t b) {
+    int scoreA = table.records[a].score, scoreB = table.records[b].score;
+    return scoreA > scoreB || (scoreA == scoreB && a < b);
+}
+
+// Days since 1 Jan 1970 of a date in the proleptic Gregorian calendar,
+// month counted from 1.
+static int32_t daysFromCivil(int year, int month, int day) {
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int yearOfEra = year - era * 400;
+    int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+
+// Like parseScoreLine(), asks localtime() once per day rather than once
+// per record: a record inside the last day looked up is on that day.
+int32_t scoreDay(int64_t time) {
+    thread_local int64_t dayStart = 0, nextDayStart = 0;
+    thread_local int32_t lastDay = 0;
+    if (time >= dayStart && time < nextDayStart) return lastDay;
+
+    tm local;
+    if (!splitTime(time, true, local)) return static_cast<int32_t>(time / (24 * 3600));
+    int year = local.tm_year + 1900, month = local.tm_mon, day = local.tm_mday;
+    int32_t number = daysFromCivil(year, month + 1, day);
+    int64_t start = localSeconds(year, month, day, 0, 0, 0);
+    int64_t next = localSeconds(year, month, day + 1, 0, 0, 0);
+    if (time >= start && time < next) {
+        dayStart = start;
+        nextDayStart = next;
+        lastDay = number;
+    }
+    return number;
+}
+
+// 1 Jan 1970 was a Thursday, three days into its week.
+int32_t scoreWeek(int64_t time) {
+    int32_t day = scoreDay(time) + 3;
+    return (day >= 0 ? day : day - 6) / 7;
+}
+
+// Day numbers are calendar dates, so the date is the one in UTC at that
+// many days since the epoch.
+string formatScoreDay(int32_t day) {
+    return formatTime(static_cast<int64_t>(day) * 24 * 3600, false, "%a %b %d %Y");
+}
+
+// Keeps the earlier record on a tie, like the rankings.
+static void noteBest(const ScoreTable& table, map<int32_t, uint32_t>& best, int32_t period, uint32_t index) {
+    // Records mostly arrive in time order, so try the latest period first.
+    auto at = !best.empty() && prev(best.end())->first == period ? prev(best.end()) : best.lower_bound(period);
+    if (at == best.end() || at->first != period) best.emplace_hint(at, period, index);
+    else if (table.records[index].score > table.records[at->second].score) at->second = index;
+}
+
+static void noteBest(const ScoreTable& table, ScoreIndex& index, int32_t day, int32_t week, uint32_t record) {
+    noteBest(table, index.bestByDay, day, record);
+    noteBest(table, index.bestByWeek, week, record);
+}
+
+// Sorts (score, index) packed into one integer, best first, rather than
+// indexes through the records: a long history sorts several times faster.
+void rankScores(ScoreTable& table, bool periods) {
+    vector<uint64_t> keys(table.records.size());
+    for (uint32_t i = 0; i < keys.size(); i++) {
+        uint32_t descending = 0xFFFFFFFFu - (static_cast<uint32_t>(table.records[i].score) ^ 0x80000000u);
+        keys[i] = static_cast<uint64_t>(descending) << 32 | i;
+    }
+    sort(keys.begin(), keys.end());
+    table.all = ScoreIndex();
+    for (ScoreIndex& index : table.byDifficulty) index = ScoreIndex();
+    table.all.ranked.resize(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) table.all.ranked[i] = static_cast<uint32_t>(keys[i]);
+    for (uint32_t i : table.all.ranked) table.byDifficulty[table.records[i].difficulty].ranked.push_back(i);
+
+    if (!periods) return;
+    for (uint32_t i = 0; i < table.records.size(); i++) {
+        int32_t day = scoreDay(table.records[i].time), week = scoreWeek(table.records[i].time);
+        noteBest(table, table.all, day, week, i);
+        noteBest(table, table.byDifficulty[table.records[i].difficulty], day, week, i);
+    }
+}
+
+void readScoreText(ScoreTable& table, istream& in) {
+    table.records.clear();
+    string line;
+    ScoreRecord record;
+    while (getline(in, line))
+        if (parseScoreLine(line, record)) table.records.push_back(record);
+    rankScores(table);
+}
+
+void loadScoreText(ScoreTable& table, const char* filename) {
+    ifstream file(filename);
+    readScoreText(table, file);
+}
+
+// The new record has the highest index, so it goes after every equal
+// score already ranked.
+static void insertRanked(const ScoreTable& table, vector<uint32_t>& ranking, uint32_t index) {
+    auto at = upper_bound(ranking.begin(), ranking.end(), index,
+                          [&table](uint32_t a, uint32_t b) { return rankedBefore(table, a, b); });
+    ranking.insert(at, index);
+}
+
+void addScore(ScoreTable& table, const ScoreRecord& record) {
+    uint32_t index = static_cast<uint32_t>(table.records.size());
+    table.records.push_back(record);
+    insertRanked(table, table.all.ranked, index);
+    insertRanked(table, table.byDifficulty[record.difficulty].ranked, index);
+    int32_t day = scoreDay(record.time), week = scoreWeek(record.time);
+    noteBest(table, table.all, day, week, index);
+    noteBest(table, table.byDifficulty[record.difficulty], day, week, index);
+}
+
+vector<uint32_t> topScores(const ScoreIndex& index, size_t n) {
+    return vector<uint32_t>(index.ranked.begin(), index.ranked.begin() + min(n, index.ranked.size()));
+}
+
+size_t scoreRank(const ScoreTable& table, const ScoreIndex& index, int score) {
+    auto beaten = partition_point(index.ranked.begin(), index.ranked.end(),
+                                  [&table, score](uint32_t i) { return table.records[i].score > score; });
+    return beaten - index.ranked.begin() + 1;
+}
+
+const ScoreRecord* bestScoreIn(const ScoreTable& table, const map<int32_t, uint32_t>& best, int32_t period) {
+    auto at = best.find(period);
+    return at == best.end() ? nullptr : &table.records[at->second];
+}
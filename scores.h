@@ -0,0 +1,73 @@
+#ifndef SCORES_H
+#define SCORES_H
+
+#include <vector>
+#include <map>
+#include <string>
+#include <istream>
+#include <stdint.h>
+
+#include "sim.h"
+
+// High scores, loaded once and kept ranked in memory, so the score screen
+// draws from the table instead of reading the history file. Every query
+// below reads an index that addScore() keeps up to date, so none of them
+// scans the history.
+
+struct ScoreRecord {
+    int score;
+    Difficulty difficulty;
+    int64_t time;   // seconds since the epoch
+};
+
+// Days count local calendar days since 1 Jan 1970; weeks run Monday to
+// Sunday and count from the one holding that day.
+struct ScoreIndex {
+    // Indexes into the table's records, best first; equal scores keep the
+    // earlier record first.
+    std::vector<uint32_t> ranked;
+    // The best race of each day and week that has one.
+    std::map<int32_t, uint32_t> bestByDay, bestByWeek;
+};
+
+struct ScoreTable {
+    std::vector<ScoreRecord> records;   // in the order they were set
+    ScoreIndex all;
+    ScoreIndex byDifficulty[HARD + 1];
+};
+
+const char* difficultyName(Difficulty difficulty);
+
+// One line of the text history: "Score: N | Difficulty: Name | Time: "
+// followed by ctime(). False for blank or unreadable lines.
+bool parseScoreLine(const std::string& line, ScoreRecord& record);
+std::string formatScoreLine(const ScoreRecord& record);
+// Local date the record was set, e.g. "Mon Jun 09 2025".
+std::string formatScoreDate(const ScoreRecord& record);
+
+// Replaces the table with every record in a text history. A missing file
+// just leaves it empty.
+void readScoreText(ScoreTable& table, std::istream& in);
+void loadScoreText(ScoreTable& table, const char* filename);
+
+// Files a finished race into the rankings.
+void addScore(ScoreTable& table, const ScoreRecord& record);
+// Ranks everything in records from scratch, after it was filled directly.
+// Without periods the best-by-day and best-by-week maps are left empty.
+void rankScores(ScoreTable& table, bool periods = true);
+
+int32_t scoreDay(int64_t time);
+int32_t scoreWeek(int64_t time);
+// Local date a day number starts on, e.g. "Mon Jun 09 2025".
+std::string formatScoreDay(int32_t day);
+
+// The best n races, best first.
+std::vector<uint32_t> topScores(const ScoreIndex& index, size_t n);
+// Where a race scoring score stands: one more than the races that beat
+// it, so it shares a rank with any equal score. O(log n).
+size_t scoreRank(const ScoreTable& table, const ScoreIndex& index, int score);
+// Best race of one day or week from bestByDay or bestByWeek, or null if
+// nobody raced then. O(log n).
+const ScoreRecord* bestScoreIn(const ScoreTable& table, const std::map<int32_t, uint32_t>& best, int32_t period);
+
+#endif
@@ -0,0 +1,453 @@
+#include "sim.h"
+#include "bytes.h"
+
+#include <iostream>
+#include <cmath>
+#include <climits>
+#include <algorithm>
+
+using namespace std;
+
+void setDifficulty(RaceState& race, Difficulty difficulty) {
+    race.difficulty = difficulty;
+    if (difficulty == EASY) {
+        race.minSpeed = 10.0f;
+        race.scoreMultiplier = 1.0f;
+        race.aiSpawnInterval = 4.0f;
+    } else if (difficulty == MEDIUM) {
+        race.minSpeed = 20.0f;
+        race.scoreMultiplier = 2.0f;
+        race.aiSpawnInterval = 2.0f;
+    } else {
+        race.minSpeed = 40.0f;
+        race.scoreMultiplier = 3.0f;
+        race.aiSpawnInterval = 1.0f;
+    }
+    race.playerSpeed = race.minSpeed;
+}
+
+void setTickRate(RaceState& race, float ticksPerSecond) {
+    race.tickSeconds = 1.0f / ticksPerSecond;
+}
+
+void initRace(RaceState& race, Difficulty difficulty, uint64_t seed, float tickSeconds) {
+    setDifficulty(race, difficulty);
+    race.seed = seed;
+    race.tickSeconds = tickSeconds;
+    resetRace(race);
+}
+
+// Most AI cars on the road at once.
+static size_t trafficLimit(const RaceState& race) {
+    if (race.maxTraffic > 0) return race.maxTraffic;
+    return race.difficulty == EASY ? 2 : race.difficulty == MEDIUM ? 3 : 4;
+}
+
+void resetRace(RaceState& race) {
+    race.player = { 800.0f, windowHeight - carHeight - bottomMargin, race.minSpeed, SPRITE_PLAYER, true, 5 };
+    reserveTraffic(race.traffic, trafficLimit(race));
+    clearTraffic(race.traffic);
+    race.raceDistance = 0;
+    race.lap = 1;
+    race.playerPosition = 1;
+    race.gameOver = false;
+    race.score = 0;
+    race.roadOffset = 0;
+    race.playerSpeed = race.minSpeed;
+    race.tick = 0;
+    race.time = 0;
+    race.scoreRemainder = 0;
+    race.nextCarId = 1;
+    seedRng(race.rng, race.seed, 0);
+    // The first car spawns on the opening tick rather than one interval in.
+    race.lastAISpawnTime = -race.aiSpawnInterval;
+    race.collisions = 0;
+    race.playerHit = false;
+}
+
+bool checkCollision(const Car& a, const Car& b) {
+    return overlaps(a.x, a.y, b.x, b.y);
+}
+
+static void resolvePlayerAICollision(RaceState& race, size_t i) {
+    Car& player = race.player;
+    float& aiX = race.traffic.x[i];
+    float& aiY = race.traffic.y[i];
+    float& aiSpeed = race.traffic.speed[i];
+    float overlapX = carWidth - abs(player.x - aiX);
+    float overlapY = carHeight - abs(player.y - aiY);
+
+    if (overlapY < overlapX) {
+        if (player.y < aiY) {
+            aiY = player.y + carHeight + collisionGap;
+            aiSpeed = max(race.minSpeed, race.playerSpeed * 0.9f);
+        } else {
+            player.y = aiY + carHeight + collisionGap;
+            race.playerSpeed = max(race.minSpeed, aiSpeed * 0.9f);
+        }
+    } else {
+        if (player.x < aiX) {
+            player.x = aiX - carWidth - collisionGap;
+        } else {
+            player.x = aiX + carWidth + collisionGap;
+        }
+        race.playerSpeed = max(race.minSpeed, race.playerSpeed * 0.95f);
+        aiSpeed = max(race.minSpeed, aiSpeed * 0.95f);
+    }
+
+    if (player.x < roadLeftBound + horizontalMargin) player.x = roadLeftBound + horizontalMargin;
+    if (player.x > roadRightBound - horizontalMargin) player.x = roadRightBound - horizontalMargin;
+    if (aiX < roadLeftBound + horizontalMargin) aiX = roadLeftBound + horizontalMargin;
+    if (aiX > roadRightBound - horizontalMargin) aiX = roadRightBound - horizontalMargin;
+
+    if (race.logCollisions)
+        cout << "Player-AI Collision: Player(" << player.x << ", " << player.y << "), AI("
+             << aiX << ", " << aiY << "), Overlap(X: " << overlapX << ", Y: " << overlapY << ")" << endl;
+}
+
+static void resolveAICarCollision(RaceState& race, size_t i, size_t j) {
+    Traffic& traffic = race.traffic;
+    float& x1 = traffic.x[i];
+    float& y1 = traffic.y[i];
+    float& speed1 = traffic.speed[i];
+    float& x2 = traffic.x[j];
+    float& y2 = traffic.y[j];
+    float& speed2 = traffic.speed[j];
+    float overlapX = carWidth - abs(x1 - x2);
+    float overlapY = carHeight - abs(y1 - y2);
+
+    if (overlapY < overlapX) {
+        if (y1 < y2) {
+            y2 = y1 + carHeight + collisionGap;
+            speed2 = max(race.minSpeed, speed1 * 0.9f);
+        } else {
+            y1 = y2 + carHeight + collisionGap;
+            speed1 = max(race.minSpeed, speed2 * 0.9f);
+        }
+    } else {
+        if (x1 < x2) {
+            x1 = x2 - carWidth - collisionGap;
+        } else {
+            x1 = x2 + carWidth + collisionGap;
+        }
+        speed1 = max(race.minSpeed, speed1 * 0.95f);
+        speed2 = max(race.minSpeed, speed2 * 0.95f);
+    }
+
+    if (x1 < roadLeftBound + horizontalMargin) x1 = roadLeftBound + horizontalMargin;
+    if (x1 > roadRightBound - horizontalMargin) x1 = roadRightBound - horizontalMargin;
+    if (x2 < roadLeftBound + horizontalMargin) x2 = roadLeftBound + horizontalMargin;
+    if (x2 > roadRightBound - horizontalMargin) x2 = roadRightBound - horizontalMargin;
+
+    if (race.logCollisions)
+        cout << "AI-AI Collision: Car1(" << x1 << ", " << y1 << "), Car2("
+             << x2 << ", " << y2 << "), Overlap(X: " << overlapX << ", Y: " << overlapY << ")" << endl;
+}
+
+// Scratch space for the collision pass, kept per thread so steady-state
+// ticks do not allocate and parallel batch races do not share it.
+static thread_local vector<pair<float, unsigned int>> sweepOrder;
+static thread_local vector<float> sweepX, sweepY;
+static thread_local vector<pair<unsigned int, unsigned int>> collisionPairs;
+
+// Sweep and prune along y: the road is only a few car widths across, so y
+// is where traffic spreads out. Only cars close enough to the screen to
+// touch a visible one take part. Once they are sorted by y, each car only
+// needs testing against the cars after it until the gap reaches a car
+// length, which overlapMask() does a block at a time. Every overlapping
+// pair comes out once, the visible car first (the lower index if both
+// are). The order depends only on positions and indices, so replays stay
+// deterministic.
+static void findTrafficPairs(const Traffic& traffic, vector<pair<unsigned int, unsigned int>>& pairs) {
+    size_t n = trafficCount(traffic);
+    const float reach = carHeight - collisionBuffer;
+    // Sized from the pool up front, so growing traffic does not allocate
+    // mid-race either. The true worst case for pairs is every car touching
+    // every other, far too much to reserve; two per car covers normal
+    // traffic, and a denser pile-up grows it once, after which it keeps
+    // that size.
+    size_t capacity = trafficCapacity(traffic);
+    sweepOrder.reserve(capacity);
+    sweepX.reserve(capacity);
+    sweepY.reserve(capacity);
+    pairs.reserve(2 * capacity);
+    sweepOrder.clear();
+    for (size_t i = 0; i < n; i++)
+        if (traffic.y[i] > -carHeight - reach) sweepOrder.push_back(make_pair(traffic.y[i], static_cast<unsigned int>(i)));
+    sort(sweepOrder.begin(), sweepOrder.end());
+
+    size_t m = sweepOrder.size();
+    sweepX.resize(m);
+    sweepY.resize(m);
+    for (size_t s = 0; s < m; s++) {
+        sweepX[s] = traffic.x[sweepOrder[s].second];
+        sweepY[s] = sweepOrder[s].first;
+    }
+
+    pairs.clear();
+    for (size_t s = 0; s < m; s++) {
+        unsigned int a = sweepOrder[s].second;
+        bool aVisible = sweepY[s] > -carHeight;
+        for (size_t t = s + 1; t < m && sweepY[t] - sweepY[s] < reach; t += collisionBlock) {
+            unsigned int mask = overlapMask(sweepX[s], sweepY[s], &sweepX[t], &sweepY[t], min(collisionBlock, m - t));
+            for (; mask; mask &= mask - 1) {
+                size_t k = t + __builtin_ctz(mask);
+                unsigned int b = sweepOrder[k].second;
+                bool bVisible = sweepY[k] > -carHeight;
+                if (!aVisible && !bVisible) continue;
+                if (aVisible && (!bVisible || a < b)) pairs.push_back(make_pair(a, b));
+                else pairs.push_back(make_pair(b, a));
+            }
+        }
+    }
+}
+
+// How far above the screen new traffic may appear. Stress runs with a large
+// maxTraffic spread their cars over enough road to hold them (about three
+// lanes), instead of piling thousands into the same 400 pixels.
+static int spawnDepth(const RaceState& race) {
+    return max(400, static_cast<int>(race.maxTraffic * (carHeight + collisionGap) / 3));
+}
+
+static void updateAI(RaceState& race) {
+    Car& player = race.player;
+    Traffic& traffic = race.traffic;
+    if (race.time - race.lastAISpawnTime > race.aiSpawnInterval && trafficCount(traffic) < trafficLimit(race)) {
+        float x = roadLeftBound + horizontalMargin + randomInt(race.rng, static_cast<int>(roadRightBound - roadLeftBound - 2 * horizontalMargin - carWidth));
+        int sprite = SPRITE_CAR1 + randomInt(race.rng, 3);
+        unsigned int id = race.nextCarId++;
+        Rng rng;
+        seedRng(rng, race.seed, id);
+        float y = static_cast<float>(-600 - randomInt(rng, spawnDepth(race)));
+        float speed = race.playerSpeed * (0.85f + randomFloat(rng) * 0.3f);
+        addTrafficCar(traffic, x, y, speed, sprite, id, rng);
+        race.lastAISpawnTime = race.time;
+    }
+
+    TrafficStep step = { player.x, race.playerSpeed, 1.0f + (race.lap - 1) * 0.5f, race.time, race.tickSeconds };
+    moveTraffic(traffic, step);
+
+    // Resolving a pair moves its cars, so each one is tested again before it
+    // is resolved; pairs only pushed together this tick are caught next tick.
+    findTrafficPairs(traffic, collisionPairs);
+    for (const auto& pair : collisionPairs) {
+        size_t i = pair.first, j = pair.second;
+        if (overlaps(traffic.x[i], traffic.y[i], traffic.x[j], traffic.y[j]))
+            resolveAICarCollision(race, i, j);
+    }
+
+    for (size_t i = 0; i < trafficCount(traffic); i++) {
+        if (traffic.y[i] > windowHeight + 200) {
+            traffic.y[i] = static_cast<float>(-600 - randomInt(traffic.rng[i], spawnDepth(race)));
+            traffic.speed[i] = race.playerSpeed * (0.85f + randomFloat(traffic.rng[i]) * 0.3f);
+        }
+    }
+
+    // A hit moves the player, so the scan carries on from the car after it
+    // with fresh masks.
+    for (size_t i = 0; i < trafficCount(traffic);) {
+        size_t count = min(collisionBlock, trafficCount(traffic) - i);
+        unsigned int mask = overlapMask(player.x, player.y, &traffic.x[i], &traffic.y[i], count);
+        if (!mask) {
+            i += count;
+            continue;
+        }
+        i += __builtin_ctz(mask);
+        player.health--;
+        race.collisions++;
+        race.playerHit = true;
+        resolvePlayerAICollision(race, i);
+        if (race.endless) {
+            // Stress runs keep their traffic: send the car back up the road.
+            traffic.y[i] = static_cast<float>(-600 - randomInt(traffic.rng[i], spawnDepth(race)));
+            i++;
+        } else {
+            removeTrafficCar(traffic, i);
+            if (player.health <= 0) race.gameOver = true;
+        }
+    }
+
+    race.playerPosition = 1;
+    for (float y : traffic.y)
+        if (y > player.y)
+            race.playerPosition++;
+}
+
+void stepRace(RaceState& race, const RaceInput& input) {
+    race.playerHit = false;
+    if (race.gameOver) return;
+
+    Car& player = race.player;
+    float dt = race.tickSeconds;
+    if (input.up) race.playerSpeed += acceleration * dt;
+    if (input.brake) race.playerSpeed -= brakeDecel * dt;
+
+    if (race.playerSpeed < race.minSpeed) race.playerSpeed = race.minSpeed;
+    if (race.playerSpeed > maxSpeed) race.playerSpeed = maxSpeed;
+
+    if (input.left) player.x -= steerSpeed * dt;
+    if (input.right) player.x += steerSpeed * dt;
+
+    if (player.x < roadLeftBound + horizontalMargin) player.x = roadLeftBound + horizontalMargin;
+    if (player.x > roadRightBound - horizontalMargin) player.x = roadRightBound - horizontalMargin;
+
+    if (player.y < bottomMargin) player.y = bottomMargin;
+    if (player.y > windowHeight - carHeight - bottomMargin) player.y = windowHeight - carHeight - bottomMargin;
+
+    race.raceDistance += race.playerSpeed * pixelsPerSpeed * dt;
+    // Score used to be awarded once per 16 ms tick; keep the same rate at
+    // any tick length and carry the fraction instead of dropping it.
+    race.scoreRemainder += (race.raceDistance / 1000.0f) * race.scoreMultiplier * defaultTickRate * dt;
+    int points = static_cast<int>(race.scoreRemainder);
+    // Endless stress runs go on long enough to overflow an int; the score
+    // stops at the top instead.
+    race.score = points > INT_MAX - race.score ? INT_MAX : race.score + points;
+    race.scoreRemainder -= points;
+
+    if (race.raceDistance >= lapDistance * race.lap && race.lap <= totalLaps) race.lap++;
+    if (race.lap > totalLaps && race.playerPosition == 1 && !race.endless) race.gameOver = true;
+
+    // Wrapped rather than reset so the scroll keeps its fraction of a screen.
+    race.roadOffset = fmod(race.roadOffset + race.playerSpeed * pixelsPerSpeed * dt, static_cast<float>(windowHeight));
+
+    updateAI(race);
+
+    race.tick++;
+    race.time = race.tick * race.tickSeconds;
+}
+
+static float lerp(float a, float b, float alpha) {
+    return a + (b - a) * alpha;
+}
+
+void interpolateRace(const RaceState& prev, const RaceState& cur, float alpha, RaceState& out) {
+    out = cur;
+    out.player.x = lerp(prev.player.x, cur.player.x, alpha);
+    out.player.y = lerp(prev.player.y, cur.player.y, alpha);
+
+    float prevOffset = prev.roadOffset;
+    if (prevOffset > cur.roadOffset) prevOffset -= windowHeight;
+    out.roadOffset = lerp(prevOffset, cur.roadOffset, alpha);
+    if (out.roadOffset < 0) out.roadOffset += windowHeight;
+
+    // cur is a later copy of prev's world, so a car's handle finds it in
+    // both; cars spawned since have no match and are drawn where they are.
+    const Traffic& old = prev.traffic;
+    Traffic& now = out.traffic;
+    for (size_t i = 0; i < trafficCount(now); i++) {
+        size_t j = findTrafficCar(old, now.handle[i]);
+        if (j == trafficCount(old) || old.id[j] != now.id[i]) continue;
+        // A car recycled to the top of the road should not sweep back
+        // across the screen, so large jumps snap instead of blending.
+        if (abs(now.y[i] - old.y[j]) < windowHeight / 2) {
+            now.x[i] = lerp(old.x[j], now.x[i], alpha);
+            now.y[i] = lerp(old.y[j], now.y[i], alpha);
+        }
+    }
+}
+
+static void writeRng(vector<uint8_t>& out, const Rng& rng) {
+    for (int i = 0; i < 4; i++) putU32(out, rng.s[i]);
+}
+
+static void readRng(ByteReader& in, Rng& rng) {
+    for (int i = 0; i < 4; i++) rng.s[i] = in.u32();
+}
+
+static void writeCar(vector<uint8_t>& out, const Car& car) {
+    putFloat(out, car.x);
+    putFloat(out, car.y);
+    putFloat(out, car.speed);
+    out.push_back(static_cast<uint8_t>(car.sprite));
+    out.push_back(car.isPlayer ? 1 : 0);
+    putU32(out, static_cast<uint32_t>(car.health));
+    putU32(out, car.id);
+    writeRng(out, car.rng);
+}
+
+static void readCar(ByteReader& in, Car& car) {
+    car.x = in.f32();
+    car.y = in.f32();
+    car.speed = in.f32();
+    car.sprite = in.u8();
+    car.isPlayer = in.u8() != 0;
+    car.health = static_cast<int>(in.u32());
+    car.id = in.u32();
+    readRng(in, car.rng);
+}
+
+void writeRaceState(vector<uint8_t>& out, const RaceState& race) {
+    out.push_back(static_cast<uint8_t>(race.difficulty));
+    putFloat(out, race.minSpeed);
+    putFloat(out, race.scoreMultiplier);
+    putFloat(out, race.aiSpawnInterval);
+    putU64(out, race.seed);
+    writeRng(out, race.rng);
+    writeCar(out, race.player);
+    const Traffic& traffic = race.traffic;
+    putU32(out, static_cast<uint32_t>(trafficCount(traffic)));
+    for (size_t i = 0; i < trafficCount(traffic); i++) {
+        Car car = { traffic.x[i], traffic.y[i], traffic.speed[i], traffic.sprite[i], false };
+        car.id = traffic.id[i];
+        car.rng = traffic.rng[i];
+        writeCar(out, car);
+    }
+    putFloat(out, race.roadOffset);
+    putFloat(out, race.playerSpeed);
+    putFloat(out, race.raceDistance);
+    putU32(out, static_cast<uint32_t>(race.lap));
+    putU32(out, static_cast<uint32_t>(race.playerPosition));
+    putU32(out, static_cast<uint32_t>(race.score));
+    out.push_back(race.gameOver ? 1 : 0);
+    putFloat(out, race.tickSeconds);
+    putU64(out, race.tick);
+    putFloat(out, race.time);
+    putFloat(out, race.lastAISpawnTime);
+    putFloat(out, race.scoreRemainder);
+    putU32(out, race.nextCarId);
+    putU32(out, static_cast<uint32_t>(race.collisions));
+    putU32(out, static_cast<uint32_t>(race.maxTraffic));
+    out.push_back(race.endless ? 1 : 0);
+}
+
+bool readRaceState(const uint8_t* data, size_t size, RaceState& race, int version) {
+    ByteReader in = { data, size, 0, true };
+    uint8_t difficulty = in.u8();
+    if (difficulty > HARD) return false;
+    race.difficulty = static_cast<Difficulty>(difficulty);
+    race.minSpeed = in.f32();
+    race.scoreMultiplier = in.f32();
+    race.aiSpawnInterval = in.f32();
+    race.seed = in.u64();
+    readRng(in, race.rng);
+    readCar(in, race.player);
+    uint32_t count = in.u32();
+    if (!in.ok || count > size) return false;
+    reserveTraffic(race.traffic, max<size_t>(count, trafficLimit(race)));
+    clearTraffic(race.traffic);
+    for (uint32_t i = 0; i < count && in.ok; i++) {
+        Car car;
+        readCar(in, car);
+        addTrafficCar(race.traffic, car.x, car.y, car.speed, car.sprite, car.id, car.rng);
+    }
+    race.roadOffset = in.f32();
+    race.playerSpeed = in.f32();
+    race.raceDistance = in.f32();
+    race.lap = static_cast<int>(in.u32());
+    race.playerPosition = static_cast<int>(in.u32());
+    race.score = static_cast<int>(in.u32());
+    race.gameOver = in.u8() != 0;
+    race.tickSeconds = in.f32();
+    race.tick = static_cast<unsigned long>(in.u64());
+    race.time = in.f32();
+    race.lastAISpawnTime = in.f32();
+    race.scoreRemainder = in.f32();
+    race.nextCarId = in.u32();
+    race.collisions = static_cast<int>(in.u32());
+    // Version 1 snapshots only came from plain races.
+    race.maxTraffic = version >= 2 ? static_cast<int>(in.u32()) : 0;
+    race.endless = version >= 2 ? in.u8() != 0 : false;
+    reserveTraffic(race.traffic, trafficLimit(race));
+    race.playerHit = false;
+    return in.ok;
+}
@@ -0,0 +1,131 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+#include <cmath>
+
+#include "rng.h"
+#include "traffic.h"
+
+// Race simulation core. Nothing in here touches GLUT or OpenGL, so the same
+// step can be driven by the windowed game or by a headless runner.
+
+const int windowWidth = 2048;
+const int windowHeight = 1152;
+
+// Rates are per second of simulated time. They were tuned as per-tick
+// steps on the old 16 ms timer, hence the factor of 62.5 below.
+const float defaultTickRate = 62.5f;
+
+const float maxSpeed = 250.0f;
+const float acceleration = 0.5f * defaultTickRate;
+const float deceleration = 0.3f * defaultTickRate;
+const float brakeDecel = 1.5f * defaultTickRate;
+
+// Road pixels travelled per second for each km/h of speed.
+const float pixelsPerSpeed = 0.5f * defaultTickRate;
+const float steerSpeed = 10.0f * defaultTickRate;
+const float aiSteerSpeed = 2.0f * defaultTickRate;
+const float aiZigzagSpeed = 1.5f * defaultTickRate;
+
+const float roadLeftBound = 300.0f;
+const float roadRightBound = 1400.0f;
+
+const float carHeight = 500.0f;
+const float carWidth = 300.0f;
+const float bottomMargin = 50.0f;
+const float horizontalMargin = 50.0f;
+const float collisionGap = 5.0f;
+const float collisionBuffer = 10.0f;
+
+// Two cars collide when their boxes, shrunk by collisionBuffer, overlap.
+inline bool overlaps(float ax, float ay, float bx, float by) {
+    return std::abs(ax - bx) < (carWidth - collisionBuffer) &&
+           std::abs(ay - by) < (carHeight - collisionBuffer);
+}
+
+const float lapDistance = 20000.0f;
+const int totalLaps = 3;
+
+enum Difficulty { EASY, MEDIUM, HARD };
+
+enum Sprite { SPRITE_PLAYER, SPRITE_CAR1, SPRITE_CAR2, SPRITE_CAR3, SPRITE_COUNT };
+
+struct Car {
+    float x, y;
+    float speed;
+    int sprite;
+    bool isPlayer;
+    int health = 5;
+    unsigned int id = 0;
+    Rng rng = {};
+};
+
+struct RaceInput {
+    bool up, left, right, brake;
+};
+
+// Everything one race needs lives in here, with no globals behind it, so a
+// world can be copied for interpolation or snapshots, serialized into a
+// replay and stepped on any thread alongside others. A default constructed
+// RaceState is a valid Medium race at the default tick rate.
+struct RaceState {
+    Difficulty difficulty = MEDIUM;
+    float minSpeed = 20.0f;
+    float scoreMultiplier = 2.0f;
+    float aiSpawnInterval = 2.0f;
+
+    uint64_t seed = 1;
+    Rng rng = {};
+
+    Car player = { 800.0f, windowHeight - carHeight - bottomMargin, 20.0f, SPRITE_PLAYER, true };
+    Traffic traffic;
+    int maxTraffic = 0;         // 0 keeps the difficulty's usual limit
+    bool endless = false;       // stress runs: neither crashing out nor finishing ends the race
+
+    float roadOffset = 0;
+    float playerSpeed = 20.0f;
+    float raceDistance = 0;
+    int lap = 1;
+    int playerPosition = 1;
+    int score = 0;
+    bool gameOver = false;
+
+    float tickSeconds = 1.0f / defaultTickRate;
+    unsigned long tick = 0;
+    float time = 0;
+    float scoreRemainder = 0;
+    unsigned int nextCarId = 1;
+    float lastAISpawnTime = 0;
+
+    int collisions = 0;
+    bool playerHit = false;     // set on any tick where the player hit traffic
+    bool logCollisions = false;
+};
+
+void setDifficulty(RaceState& race, Difficulty difficulty);
+void setTickRate(RaceState& race, float ticksPerSecond);
+// Starts a new race. Everything random is derived from race.seed, so two
+// resets with the same seed and inputs play out identically.
+void resetRace(RaceState& race);
+// Shorthand for setting difficulty, seed and tick length and resetting.
+void initRace(RaceState& race, Difficulty difficulty, uint64_t seed, float tickSeconds);
+void stepRace(RaceState& race, const RaceInput& input);
+
+// Blends two consecutive ticks for drawing; alpha 0 is prev, 1 is cur.
+// Only positions are blended, everything else is taken from cur.
+void interpolateRace(const RaceState& prev, const RaceState& cur, float alpha, RaceState& out);
+
+// Little-endian snapshot of everything stepRace() reads, stress-run
+// settings included. Only logCollisions, which just prints, is left alone
+// by readRaceState. version is the format the data was written in; version
+// 1 predates maxTraffic and endless.
+const int raceStateVersion = 2;
+void writeRaceState(std::vector<uint8_t>& out, const RaceState& race);
+bool readRaceState(const uint8_t* data, size_t size, RaceState& race, int version = raceStateVersion);
+
+bool checkCollision(const Car& a, const Car& b);
+
+#endif
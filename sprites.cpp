@@ -0,0 +1,99 @@
+#include "sprites.h"
+
+#include <GL/freeglut_ext.h>
+#include <GL/glext.h>
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+
+using namespace std;
+
+struct SpriteQuad {
+    GLuint texture;
+    unsigned int order;
+    float x, y, w, h;
+    SpriteUV uv;
+    uint32_t color;
+};
+
+struct SpriteVertex {
+    float x, y, u, v;
+    uint32_t color;
+};
+
+static vector<SpriteQuad> queued;
+static vector<SpriteVertex> vertices;
+
+// GL 1.5 buffer entry points, looked up at runtime since opengl32 on
+// Windows only exports GL 1.1.
+static PFNGLGENBUFFERSPROC genBuffers = nullptr;
+static PFNGLBINDBUFFERPROC bindBuffer = nullptr;
+static PFNGLBUFFERDATAPROC bufferData = nullptr;
+static GLuint vertexBuffer = 0;
+
+void initSprites() {
+    genBuffers = reinterpret_cast<PFNGLGENBUFFERSPROC>(glutGetProcAddress("glGenBuffers"));
+    bindBuffer = reinterpret_cast<PFNGLBINDBUFFERPROC>(glutGetProcAddress("glBindBuffer"));
+    bufferData = reinterpret_cast<PFNGLBUFFERDATAPROC>(glutGetProcAddress("glBufferData"));
+    if (genBuffers && bindBuffer && bufferData) genBuffers(1, &vertexBuffer);
+    queued.reserve(256);
+    vertices.reserve(256 * 4);
+}
+
+void drawSprite(GLuint texture, float x, float y, float w, float h, const SpriteUV& uv, uint32_t color) {
+    SpriteQuad quad = { texture, static_cast<unsigned int>(queued.size()), x, y, w, h, uv, color };
+    queued.push_back(quad);
+}
+
+void flushSprites() {
+    if (queued.empty()) return;
+
+    // Group by texture, keeping queue order within a texture.
+    sort(queued.begin(), queued.end(), [](const SpriteQuad& a, const SpriteQuad& b) {
+        return a.texture < b.texture || (a.texture == b.texture && a.order < b.order);
+    });
+    vertices.clear();
+    for (const SpriteQuad& q : queued) {
+        SpriteVertex corners[4] = {
+            { q.x, q.y, q.uv.u0, q.uv.v0, q.color },
+            { q.x + q.w, q.y, q.uv.u1, q.uv.v0, q.color },
+            { q.x + q.w, q.y + q.h, q.uv.u1, q.uv.v1, q.color },
+            { q.x, q.y + q.h, q.uv.u0, q.uv.v1, q.color },
+        };
+        vertices.insert(vertices.end(), corners, corners + 4);
+    }
+
+    const char* base = reinterpret_cast<const char*>(vertices.data());
+    if (vertexBuffer) {
+        // Orphan last frame's storage and refill it, so the driver never
+        // waits on a draw still reading the old contents.
+        bindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        bufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(SpriteVertex), vertices.data(), GL_STREAM_DRAW);
+        base = nullptr;
+    }
+
+    glEnable(GL_TEXTURE_2D);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(2, GL_FLOAT, sizeof(SpriteVertex), base + offsetof(SpriteVertex, x));
+    glTexCoordPointer(2, GL_FLOAT, sizeof(SpriteVertex), base + offsetof(SpriteVertex, u));
+    glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(SpriteVertex), base + offsetof(SpriteVertex, color));
+
+    size_t first = 0;
+    while (first < queued.size()) {
+        size_t last = first + 1;
+        while (last < queued.size() && queued[last].texture == queued[first].texture) last++;
+        glBindTexture(GL_TEXTURE_2D, queued[first].texture);
+        glDrawArrays(GL_QUADS, static_cast<GLint>(first * 4), static_cast<GLsizei>((last - first) * 4));
+        first = last;
+    }
+
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisable(GL_TEXTURE_2D);
+    if (vertexBuffer) bindBuffer(GL_ARRAY_BUFFER, 0);
+    queued.clear();
+}
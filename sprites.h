@@ -0,0 +1,35 @@
+#ifndef SPRITES_H
+#define SPRITES_H
+
+#include <GL/glut.h>
+#include <stdint.h>
+
+// Batched textured quads. drawSprite() only queues a quad; flushSprites()
+// sorts the queue by texture, uploads it in one go and issues one draw per
+// texture. Sprites queued between two flushes may be drawn in any order,
+// so flush between layers that must stay on top of each other.
+
+// Part of a texture, in texture coordinates.
+struct SpriteUV {
+    float u0, v0, u1, v1;
+};
+
+const SpriteUV wholeTexture = { 0, 0, 1, 1 };
+
+// Vertex colour, multiplied with the texture: bytes R, G, B, A in memory.
+inline uint32_t spriteColor(float r, float g, float b, float a = 1.0f) {
+    return static_cast<uint32_t>(r * 255 + 0.5f) | (static_cast<uint32_t>(g * 255 + 0.5f) << 8) |
+           (static_cast<uint32_t>(b * 255 + 0.5f) << 16) | (static_cast<uint32_t>(a * 255 + 0.5f) << 24);
+}
+
+const uint32_t spriteWhite = 0xFFFFFFFF;
+
+// Call once the GL context exists. Uses a vertex buffer object when the
+// driver has one and plain client-side vertex arrays otherwise.
+void initSprites();
+
+void drawSprite(GLuint texture, float x, float y, float w, float h,
+                const SpriteUV& uv = wholeTexture, uint32_t color = spriteWhite);
+void flushSprites();
+
+#endif
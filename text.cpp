@@ -0,0 +1,118 @@
+#include "text.h"
+
+#include <GL/freeglut_ext.h>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+static void* const textFont = GLUT_BITMAP_HELVETICA_18;
+static const int firstGlyph = 32, glyphCount = 95;
+static const int glyphColumns = 16;
+static const int glyphPad = 2;
+
+// Every glyph gets a cell of the same size with its baseline descent
+// texels above the bottom; quads cover the whole cell so nothing that
+// overhangs the advance is cut off.
+static GLuint glyphTexture = 0;
+static int cellWidth = 0, cellHeight = 0, descent = 0, lineHeight = 0;
+static int atlasWidth = 0, atlasHeight = 0;
+static float glyphAdvance[glyphCount];
+
+void initText() {
+    if (glyphTexture) return;
+
+    lineHeight = glutBitmapHeight(textFont);
+    descent = lineHeight / 3;
+    int widest = 0;
+    for (int i = 0; i < glyphCount; i++) {
+        glyphAdvance[i] = static_cast<float>(glutBitmapWidth(textFont, firstGlyph + i));
+        widest = max(widest, static_cast<int>(glyphAdvance[i]));
+    }
+    cellWidth = widest + 2 * glyphPad;
+    cellHeight = lineHeight + descent + glyphPad;
+    atlasWidth = glyphColumns * cellWidth;
+    atlasHeight = (glyphCount + glyphColumns - 1) / glyphColumns * cellHeight;
+
+    // Draw the glyphs white on black in the bottom-left corner of the back
+    // buffer, in window pixels, then copy that corner into an intensity
+    // texture: coverage ends up in both colour and alpha.
+    glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_CURRENT_BIT | GL_TRANSFORM_BIT);
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    gluOrtho2D(0, glutGet(GLUT_WINDOW_WIDTH), 0, glutGet(GLUT_WINDOW_HEIGHT));
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    glDisable(GL_TEXTURE_2D);
+    glDisable(GL_BLEND);
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glColor3f(1, 1, 1);
+    for (int i = 0; i < glyphCount; i++) {
+        glRasterPos2i(i % glyphColumns * cellWidth + glyphPad, i / glyphColumns * cellHeight + descent);
+        glutBitmapCharacter(textFont, firstGlyph + i);
+    }
+
+    glGenTextures(1, &glyphTexture);
+    glBindTexture(GL_TEXTURE_2D, glyphTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_INTENSITY, atlasWidth, atlasHeight, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, nullptr);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, atlasWidth, atlasHeight);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopMatrix();
+    glPopAttrib();
+}
+
+void drawText(float x, float y, const string& text, float scale, uint32_t color) {
+    // At 1:1 the pen stays on whole pixels so the filter leaves glyphs
+    // sharp.
+    if (scale == 1.0f) {
+        x = floor(x + 0.5f);
+        y = floor(y + 0.5f);
+    }
+    float penX = x, penY = y;
+    for (char c : text) {
+        if (c == '\n') {
+            penX = x;
+            penY += lineHeight * scale;
+            continue;
+        }
+        int glyph = static_cast<unsigned char>(c) - firstGlyph;
+        if (glyph < 0 || glyph >= glyphCount) continue;
+        int column = glyph % glyphColumns, row = glyph / glyphColumns;
+        // The atlas was copied bottom-up, so v runs from the cell's top
+        // edge down to its bottom.
+        SpriteUV uv = { static_cast<float>(column * cellWidth) / atlasWidth,
+                        static_cast<float>((row + 1) * cellHeight) / atlasHeight,
+                        static_cast<float>((column + 1) * cellWidth) / atlasWidth,
+                        static_cast<float>(row * cellHeight) / atlasHeight };
+        drawSprite(glyphTexture, penX - glyphPad * scale, penY - (cellHeight - descent) * scale,
+                   cellWidth * scale, cellHeight * scale, uv, color);
+        penX += glyphAdvance[glyph] * scale;
+    }
+}
+
+float textWidth(const string& text, float scale) {
+    float width = 0, line = 0;
+    for (char c : text) {
+        int glyph = static_cast<unsigned char>(c) - firstGlyph;
+        if (c == '\n') line = 0;
+        else if (glyph >= 0 && glyph < glyphCount) line += glyphAdvance[glyph];
+        width = max(width, line);
+    }
+    return width * scale;
+}
+
+float textLineHeight(float scale) {
+    return lineHeight * scale;
+}
@@ -0,0 +1,25 @@
+#ifndef TEXT_H
+#define TEXT_H
+
+#include <string>
+
+#include "sprites.h"
+
+// Text drawn through the sprite batch from a glyph atlas. GLUT's Helvetica
+// 18 is rasterized into a texture once, so a string costs one quad per
+// character in the next flushSprites() instead of a glBitmap call each.
+// Printable ASCII only; '\n' starts a new line.
+
+// Bakes the atlas. It is drawn in the back buffer and copied out, so call
+// it from the display callback before the frame is cleared; later calls
+// return straight away.
+void initText();
+
+// x is the left edge and y the baseline of the first line, both scaled
+// from 18 pixel glyphs.
+void drawText(float x, float y, const std::string& text, float scale = 1.0f, uint32_t color = spriteWhite);
+// Width of the widest line.
+float textWidth(const std::string& text, float scale = 1.0f);
+float textLineHeight(float scale = 1.0f);
+
+#endif
@@ -0,0 +1,253 @@
+#include "textures.h"
+#include "assets.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+
+using namespace std;
+
+// Decoded pixels are kept in assetCacheFile between runs (see assets.h);
+// bump spriteCookVersion whenever the way sprites are cooked changes.
+static const char* assetCacheFile = "assets.cache";
+static const uint64_t spriteCookVersion = 1;
+static const char* roadFile = "ROAD.png";
+static const char* spriteFiles[SPRITE_COUNT] = { "PLAYER.png", "CAR1.png", "CAR2.png", "CAR3.png" };
+
+typedef chrono::steady_clock Clock;
+
+static double millisecondsSince(Clock::time_point start) {
+    return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+// One texture on its way in. Workers fill in the pixels and set decoded;
+// the GL thread uploads and sets uploaded.
+struct TextureJob {
+    string name;
+    uint64_t key = 0;
+    bool cached = false;
+    bool decoded = false;
+    bool uploaded = false;
+    double decodeMs = 0, uploadMs = 0;
+    size_t sourceBytes = 0;           // the source images decoded at their own size
+    vector<AtlasImage> levels;        // decoded here
+    vector<AtlasLevel> upload;        // what glTexImage2D reads, from levels or the cache
+};
+
+static TextureJob roadJob, spriteJob;
+static Atlas spriteLayout;
+static vector<AtlasImage> carImages;
+static int carsLeft = 0;
+static Clock::time_point loadStart, spriteStart;
+
+static AssetCache cache;
+static mutex loadMutex;
+static condition_variable taskReady;
+static deque<function<void()> > tasks;
+static bool stopping = false;
+static vector<thread> workers;
+
+static void addTask(function<void()> task) {
+    lock_guard<mutex> lock(loadMutex);
+    tasks.push_back(task);
+    taskReady.notify_one();
+}
+
+static void workerLoop() {
+    for (;;) {
+        function<void()> task;
+        {
+            unique_lock<mutex> lock(loadMutex);
+            taskReady.wait(lock, [] { return stopping || !tasks.empty(); });
+            if (tasks.empty()) return;
+            task = tasks.front();
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+static void markDecoded(TextureJob& job, Clock::time_point start) {
+    lock_guard<mutex> lock(loadMutex);
+    job.decodeMs = millisecondsSince(start);
+    if (job.upload.empty())
+        for (const AtlasImage& level : job.levels) {
+            AtlasLevel view = { level.width, level.height, level.rgba.data() };
+            job.upload.push_back(view);
+        }
+    job.decoded = true;
+}
+
+static void loadRoad() {
+    Clock::time_point start = Clock::now();
+    roadJob.key = hashFile(roadFile);
+    if (const CachedImage* cached = findCachedImage(cache, roadFile, roadJob.key)) {
+        AtlasLevel level = { cached->width, cached->height, cached->rgba };
+        roadJob.upload.push_back(level);
+        roadJob.cached = true;
+    } else {
+        roadJob.levels.push_back(loadAtlasImage(roadFile));
+    }
+    markDecoded(roadJob, start);
+}
+
+// Runs once per car; whichever finishes last builds the atlas.
+static void loadCar(int sprite) {
+    AtlasImage source = loadAtlasImage(spriteFiles[sprite]);
+    AtlasImage image = resizeAtlasImage(source, static_cast<int>(carWidth), static_cast<int>(carHeight));
+    {
+        lock_guard<mutex> lock(loadMutex);
+        spriteJob.sourceBytes += source.rgba.size();
+        carImages[sprite] = image;
+        if (--carsLeft > 0) return;
+    }
+    carImages[atlasWhite] = whiteAtlasImage();
+    composeAtlas(spriteLayout, carImages, spriteJob.levels);
+    carImages.clear();
+    markDecoded(spriteJob, spriteStart);
+}
+
+static void loadSprites() {
+    spriteStart = Clock::now();
+    spriteJob.key = hashCombine(hashCombine(spriteCookVersion, static_cast<uint64_t>(carWidth)), static_cast<uint64_t>(carHeight));
+    for (const char* file : spriteFiles) spriteJob.key = hashCombine(spriteJob.key, hashFile(file));
+
+    for (int width = spriteLayout.width, height = spriteLayout.height;; width = max(1, width / 2), height = max(1, height / 2)) {
+        const CachedImage* cached = findCachedImage(cache, "sprites.mip" + to_string(spriteJob.upload.size()), spriteJob.key);
+        if (!cached || cached->width != width || cached->height != height) {
+            spriteJob.upload.clear();
+            break;
+        }
+        AtlasLevel level = { width, height, cached->rgba };
+        spriteJob.upload.push_back(level);
+        if (width == 1 && height == 1) break;
+    }
+    if (!spriteJob.upload.empty()) {
+        // Only the headers are read, to report the memory the atlas saves.
+        for (const char* file : spriteFiles) spriteJob.sourceBytes += atlasImageBytes(file);
+        spriteJob.cached = true;
+        markDecoded(spriteJob, spriteStart);
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(loadMutex);
+        carImages.assign(SPRITE_COUNT + 1, AtlasImage());
+        carsLeft = SPRITE_COUNT;
+    }
+    for (int i = 0; i < SPRITE_COUNT; i++) addTask([i] { loadCar(i); });
+}
+
+// Lets the workers finish the task in hand and drops the rest, so quitting
+// mid-load does not wait for it or leave threads behind.
+static void stopWorkers() {
+    {
+        lock_guard<mutex> lock(loadMutex);
+        stopping = true;
+        tasks.clear();
+        taskReady.notify_all();
+    }
+    for (thread& worker : workers) worker.join();
+    workers.clear();
+}
+
+void startTextureLoading(GameTextures& textures, int threads) {
+    loadStart = Clock::now();
+    textures.road = textures.sprites.texture = 0;
+    textures.sprites.regions.assign(SPRITE_COUNT + 1, wholeTexture);
+    openAssetCache(cache, assetCacheFile);
+
+    roadJob.name = roadFile;
+    spriteJob.name = "car sprites";
+    // The layout only needs sizes and the GL limit, so it is settled here
+    // and the workers just fill it in.
+    AtlasImage white = whiteAtlasImage();
+    vector<AtlasRect> sizes(SPRITE_COUNT + 1);
+    for (int i = 0; i < SPRITE_COUNT; i++) sizes[i] = { 0, 0, static_cast<int>(carWidth), static_cast<int>(carHeight) };
+    sizes[atlasWhite] = { 0, 0, white.width, white.height };
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    bool atlasFits = layoutAtlas(spriteLayout, sizes, maxSize);
+
+    stopping = false;
+    for (int i = 0; i < max(1, threads); i++) workers.emplace_back(workerLoop);
+    atexit(stopWorkers);
+    addTask(loadRoad);
+    if (atlasFits) addTask(loadSprites);
+    else markDecoded(spriteJob, Clock::now());
+}
+
+static void uploadJob(TextureJob& job, GameTextures& textures) {
+    Clock::time_point start = Clock::now();
+    if (&job == &roadJob) {
+        const AtlasLevel& level = job.upload[0];
+        glGenTextures(1, &textures.road);
+        glBindTexture(GL_TEXTURE_2D, textures.road);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, level.width, level.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, level.rgba);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        // The race scrolls the road through its texture coordinates.
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        if (!job.cached) addCachedImage(cache, roadFile, job.key, level.width, level.height, level.rgba);
+    } else {
+        textures.sprites = spriteLayout;
+        if (!job.upload.empty()) uploadAtlas(textures.sprites, job.upload);
+        if (!job.cached)
+            for (size_t mip = 0; mip < job.upload.size(); mip++)
+                addCachedImage(cache, "sprites.mip" + to_string(mip), job.key, job.upload[mip].width,
+                               job.upload[mip].height, job.upload[mip].rgba);
+    }
+    job.uploadMs = millisecondsSince(start);
+    job.uploaded = true;
+    job.levels.clear();
+    job.upload.clear();
+}
+
+bool pollTextureLoading(GameTextures& textures) {
+    TextureJob* jobs[2] = { &roadJob, &spriteJob };
+    for (TextureJob* job : jobs) {
+        bool ready;
+        {
+            lock_guard<mutex> lock(loadMutex);
+            ready = job->decoded;
+        }
+        if (ready && !job->uploaded) uploadJob(*job, textures);
+    }
+    if (!roadJob.uploaded || !spriteJob.uploaded) return false;
+    if (workers.empty()) return true;
+
+    stopWorkers();
+    if (!cache.fresh.empty()) saveAssetCache(cache, assetCacheFile);
+    else closeAssetCache(cache);
+
+    for (TextureJob* job : jobs) {
+        cout << "Texture " << job->name << ": " << (job->cached ? "cached" : "decoded") << " in " << job->decodeMs
+             << " ms, uploaded in " << job->uploadMs << " ms" << endl;
+    }
+    if (textures.sprites.texture)
+        cout << "Car sprites: " << spriteJob.sourceBytes / 1024 << " KB at source size, " << textures.sprites.bytes / 1024
+             << " KB in a " << textures.sprites.width << "x" << textures.sprites.height << " atlas with mipmaps" << endl;
+    cout << "Textures ready in " << millisecondsSince(loadStart) << " ms" << endl;
+    return true;
+}
+
+uint32_t roadTint(const GameTextures& textures) {
+    return textures.road ? spriteWhite : spriteColor(0.3f, 0.3f, 0.32f);
+}
+
+uint32_t spriteTint(const GameTextures& textures, int sprite) {
+    if (textures.sprites.texture) return spriteWhite;
+    static const uint32_t standIns[SPRITE_COUNT + 1] = {
+        spriteColor(0.2f, 0.4f, 0.9f), spriteColor(0.85f, 0.2f, 0.2f), spriteColor(0.95f, 0.75f, 0.2f),
+        spriteColor(0.3f, 0.75f, 0.35f), spriteWhite
+    };
+    return standIns[sprite];
+}
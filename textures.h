@@ -0,0 +1,32 @@
+#ifndef TEXTURES_H
+#define TEXTURES_H
+
+#include "sim.h"
+#include "atlas.h"
+
+// Loading the game's textures. PNG decoding, car resizing and atlas mips
+// run on worker threads, checking the asset cache first; the GL thread
+// only uploads each texture once its pixels are ready.
+
+struct GameTextures {
+    GLuint road = 0;
+    Atlas sprites;   // cars indexed by Sprite, then a white patch
+};
+
+const int atlasWhite = SPRITE_COUNT;
+
+// Starts the workers and returns straight away. Call once the GL context
+// exists; textures is usable at once, drawing stand-ins (see below).
+void startTextureLoading(GameTextures& textures, int threads);
+// Uploads whatever has finished decoding; GL thread only, once a frame.
+// Returns true once every texture is resident, after which the workers
+// are gone and per-asset decode and upload times have been printed.
+bool pollTextureLoading(GameTextures& textures);
+
+// Colours to draw textures with. A texture that is not resident yet has
+// handle 0, which GL draws as bare vertex colour, so until then these
+// give flat stand-ins; afterwards they are white, the texture as it is.
+uint32_t roadTint(const GameTextures& textures);
+uint32_t spriteTint(const GameTextures& textures, int sprite);
+
+#endif
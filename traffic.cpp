@@ -0,0 +1,262 @@
+#include "traffic.h"
+#include "sim.h"
+
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__) && !defined(RACE_NO_SIMD)
+#include <emmintrin.h>
+#define TRAFFIC_SSE2 1
+#endif
+
+using namespace std;
+
+static const float twoPi = 6.28318530718f;
+static const float invTwoPi = 0.159154943092f;
+static const float sinC3 = -1.0f / 6.0f;
+static const float sinC5 = 1.0f / 120.0f;
+static const float sinC7 = -1.0f / 5040.0f;
+static const float sinC9 = 1.0f / 362880.0f;
+
+static const uint32_t slotBits = 16;
+static const size_t maxTrafficCapacity = size_t(1) << slotBits;
+
+static TrafficHandle makeHandle(uint32_t slot, uint16_t generation) {
+    return slot | (static_cast<uint32_t>(generation) << slotBits);
+}
+
+size_t trafficCount(const Traffic& traffic) {
+    return traffic.x.size();
+}
+
+size_t trafficCapacity(const Traffic& traffic) {
+    return traffic.slotIndex.size();
+}
+
+void reserveTraffic(Traffic& traffic, size_t capacity) {
+    capacity = min(capacity, maxTrafficCapacity);
+    size_t old = trafficCapacity(traffic);
+    if (capacity <= old) return;
+    traffic.x.reserve(capacity);
+    traffic.y.reserve(capacity);
+    traffic.speed.reserve(capacity);
+    traffic.sprite.reserve(capacity);
+    traffic.id.reserve(capacity);
+    traffic.rng.reserve(capacity);
+    traffic.handle.reserve(capacity);
+    traffic.slotIndex.resize(capacity, 0);
+    traffic.slotGeneration.resize(capacity, 0);
+    // New slots go under the existing free ones, lowest handed out first.
+    traffic.freeSlots.reserve(capacity);
+    traffic.freeSlots.insert(traffic.freeSlots.begin(), capacity - old, 0);
+    for (size_t i = 0; i < capacity - old; i++)
+        traffic.freeSlots[i] = static_cast<uint32_t>(capacity - 1 - i);
+}
+
+void clearTraffic(Traffic& traffic) {
+    for (TrafficHandle handle : traffic.handle)
+        traffic.slotGeneration[handle & (maxTrafficCapacity - 1)]++;
+    traffic.x.clear();
+    traffic.y.clear();
+    traffic.speed.clear();
+    traffic.sprite.clear();
+    traffic.id.clear();
+    traffic.rng.clear();
+    traffic.handle.clear();
+    size_t capacity = trafficCapacity(traffic);
+    traffic.freeSlots.resize(capacity);
+    for (size_t i = 0; i < capacity; i++)
+        traffic.freeSlots[i] = static_cast<uint32_t>(capacity - 1 - i);
+}
+
+TrafficHandle addTrafficCar(Traffic& traffic, float x, float y, float speed, int sprite, unsigned int id, const Rng& rng) {
+    if (traffic.freeSlots.empty()) return noTrafficCar;
+    uint32_t slot = traffic.freeSlots.back();
+    traffic.freeSlots.pop_back();
+    TrafficHandle handle = makeHandle(slot, traffic.slotGeneration[slot]);
+    traffic.slotIndex[slot] = static_cast<uint32_t>(trafficCount(traffic));
+    traffic.x.push_back(x);
+    traffic.y.push_back(y);
+    traffic.speed.push_back(speed);
+    traffic.sprite.push_back(sprite);
+    traffic.id.push_back(id);
+    traffic.rng.push_back(rng);
+    traffic.handle.push_back(handle);
+    return handle;
+}
+
+void removeTrafficCar(Traffic& traffic, size_t i) {
+    uint32_t slot = traffic.handle[i] & (maxTrafficCapacity - 1);
+    traffic.slotGeneration[slot]++;
+    traffic.freeSlots.push_back(slot);
+
+    size_t last = trafficCount(traffic) - 1;
+    if (i != last) {
+        traffic.x[i] = traffic.x[last];
+        traffic.y[i] = traffic.y[last];
+        traffic.speed[i] = traffic.speed[last];
+        traffic.sprite[i] = traffic.sprite[last];
+        traffic.id[i] = traffic.id[last];
+        traffic.rng[i] = traffic.rng[last];
+        traffic.handle[i] = traffic.handle[last];
+        traffic.slotIndex[traffic.handle[i] & (maxTrafficCapacity - 1)] = static_cast<uint32_t>(i);
+    }
+    traffic.x.pop_back();
+    traffic.y.pop_back();
+    traffic.speed.pop_back();
+    traffic.sprite.pop_back();
+    traffic.id.pop_back();
+    traffic.rng.pop_back();
+    traffic.handle.pop_back();
+}
+
+size_t findTrafficCar(const Traffic& traffic, TrafficHandle handle) {
+    uint32_t slot = handle & (maxTrafficCapacity - 1);
+    if (handle == noTrafficCar || slot >= trafficCapacity(traffic) ||
+        makeHandle(slot, traffic.slotGeneration[slot]) != handle)
+        return trafficCount(traffic);
+    return traffic.slotIndex[slot];
+}
+
+float zigzagSin(float x) {
+    float k = static_cast<float>(lrintf(x * invTwoPi));
+    float r = x - k * twoPi;
+    float r2 = r * r;
+    return r * (1.0f + r2 * (sinC3 + r2 * (sinC5 + r2 * (sinC7 + r2 * sinC9))));
+}
+
+static void moveCar(Traffic& traffic, size_t i, const TrafficStep& step, float steer, float zigzagScale) {
+    float speed = step.playerSpeed * (0.85f + randomFloat(traffic.rng[i]) * 0.3f);
+    float y = traffic.y[i] + speed * pixelsPerSpeed * step.dt;
+    traffic.speed[i] = speed;
+    traffic.y[i] = y;
+
+    if (y > -carHeight) {
+        float x = traffic.x[i];
+        if (x < step.playerX) x += steer;
+        else if (x > step.playerX) x -= steer;
+
+        x += zigzagSin(step.time + y * 0.01f) * zigzagScale * step.dt;
+
+        if (x < roadLeftBound + horizontalMargin) x = roadLeftBound + horizontalMargin;
+        if (x > roadRightBound - horizontalMargin) x = roadRightBound - horizontalMargin;
+        traffic.x[i] = x;
+    }
+}
+
+#ifdef TRAFFIC_SSE2
+static inline __m128i rotl32x4(__m128i v, int k) {
+    return _mm_or_si128(_mm_slli_epi32(v, k), _mm_srli_epi32(v, 32 - k));
+}
+
+// xoshiro128** for four cars at once. SSE2 has no 32-bit multiply, but the
+// constants 5 and 9 are a shift and an add.
+static inline __m128i nextRandom4(__m128i& s0, __m128i& s1, __m128i& s2, __m128i& s3) {
+    __m128i times5 = _mm_add_epi32(_mm_slli_epi32(s1, 2), s1);
+    __m128i rotated = rotl32x4(times5, 7);
+    __m128i result = _mm_add_epi32(_mm_slli_epi32(rotated, 3), rotated);
+    __m128i t = _mm_slli_epi32(s1, 9);
+    s2 = _mm_xor_si128(s2, s0);
+    s3 = _mm_xor_si128(s3, s1);
+    s1 = _mm_xor_si128(s1, s2);
+    s0 = _mm_xor_si128(s0, s3);
+    s2 = _mm_xor_si128(s2, t);
+    s3 = rotl32x4(s3, 11);
+    return result;
+}
+
+static inline __m128 zigzagSin4(__m128 x) {
+    __m128 k = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(invTwoPi))));
+    __m128 r = _mm_sub_ps(x, _mm_mul_ps(k, _mm_set1_ps(twoPi)));
+    __m128 r2 = _mm_mul_ps(r, r);
+    __m128 p = _mm_add_ps(_mm_set1_ps(sinC7), _mm_mul_ps(r2, _mm_set1_ps(sinC9)));
+    p = _mm_add_ps(_mm_set1_ps(sinC5), _mm_mul_ps(r2, p));
+    p = _mm_add_ps(_mm_set1_ps(sinC3), _mm_mul_ps(r2, p));
+    p = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(r2, p));
+    return _mm_mul_ps(r, p);
+}
+
+static inline __m128 select4(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+#endif
+
+unsigned int overlapMask(float x, float y, const float* xs, const float* ys, size_t count) {
+    unsigned int mask = 0;
+    size_t k = 0;
+#ifdef TRAFFIC_SSE2
+    if (count == collisionBlock) {
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+        const __m128 x4 = _mm_set1_ps(x), y4 = _mm_set1_ps(y);
+        const __m128 width = _mm_set1_ps(carWidth - collisionBuffer);
+        const __m128 height = _mm_set1_ps(carHeight - collisionBuffer);
+        for (; k < collisionBlock; k += 4) {
+            __m128 dx = _mm_and_ps(_mm_sub_ps(x4, _mm_loadu_ps(xs + k)), absMask);
+            __m128 dy = _mm_and_ps(_mm_sub_ps(y4, _mm_loadu_ps(ys + k)), absMask);
+            __m128 hit = _mm_and_ps(_mm_cmplt_ps(dx, width), _mm_cmplt_ps(dy, height));
+            mask |= static_cast<unsigned int>(_mm_movemask_ps(hit)) << k;
+        }
+    }
+#endif
+    for (; k < count; k++)
+        if (overlaps(x, y, xs[k], ys[k])) mask |= 1u << k;
+    return mask;
+}
+
+void moveTraffic(Traffic& traffic, const TrafficStep& step) {
+    size_t n = trafficCount(traffic);
+    float steer = aiSteerSpeed * step.aggression * step.dt;
+    size_t i = 0;
+
+#ifdef TRAFFIC_SSE2
+    const __m128 playerX = _mm_set1_ps(step.playerX);
+    const __m128 playerSpeed = _mm_set1_ps(step.playerSpeed);
+    const __m128 dt = _mm_set1_ps(step.dt);
+    const __m128 steer4 = _mm_set1_ps(steer);
+    const __m128 time = _mm_set1_ps(step.time);
+    const __m128 leftLimit = _mm_set1_ps(roadLeftBound + horizontalMargin);
+    const __m128 rightLimit = _mm_set1_ps(roadRightBound - horizontalMargin);
+    float* rngWords = reinterpret_cast<float*>(traffic.rng.data());
+
+    for (; i + 4 <= n; i += 4) {
+        // Rng is four words per car; transpose so each register holds one
+        // state word for all four cars, and back again afterwards.
+        __m128 r0 = _mm_loadu_ps(rngWords + 4 * i);
+        __m128 r1 = _mm_loadu_ps(rngWords + 4 * i + 4);
+        __m128 r2 = _mm_loadu_ps(rngWords + 4 * i + 8);
+        __m128 r3 = _mm_loadu_ps(rngWords + 4 * i + 12);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        __m128i s0 = _mm_castps_si128(r0), s1 = _mm_castps_si128(r1);
+        __m128i s2 = _mm_castps_si128(r2), s3 = _mm_castps_si128(r3);
+        __m128i bits = nextRandom4(s0, s1, s2, s3);
+        r0 = _mm_castsi128_ps(s0);
+        r1 = _mm_castsi128_ps(s1);
+        r2 = _mm_castsi128_ps(s2);
+        r3 = _mm_castsi128_ps(s3);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        _mm_storeu_ps(rngWords + 4 * i, r0);
+        _mm_storeu_ps(rngWords + 4 * i + 4, r1);
+        _mm_storeu_ps(rngWords + 4 * i + 8, r2);
+        _mm_storeu_ps(rngWords + 4 * i + 12, r3);
+
+        __m128 unit = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(bits, 8)), _mm_set1_ps(1.0f / 16777216.0f));
+        __m128 speed = _mm_mul_ps(playerSpeed, _mm_add_ps(_mm_set1_ps(0.85f), _mm_mul_ps(unit, _mm_set1_ps(0.3f))));
+        __m128 y = _mm_add_ps(_mm_loadu_ps(&traffic.y[i]), _mm_mul_ps(_mm_mul_ps(speed, _mm_set1_ps(pixelsPerSpeed)), dt));
+        _mm_storeu_ps(&traffic.speed[i], speed);
+        _mm_storeu_ps(&traffic.y[i], y);
+
+        __m128 x = _mm_loadu_ps(&traffic.x[i]);
+        __m128 visible = _mm_cmpgt_ps(y, _mm_set1_ps(-carHeight));
+        __m128 steerDelta = _mm_sub_ps(_mm_and_ps(_mm_cmplt_ps(x, playerX), steer4),
+                                       _mm_and_ps(_mm_cmpgt_ps(x, playerX), steer4));
+        __m128 moved = _mm_add_ps(x, steerDelta);
+        __m128 zigzag = _mm_mul_ps(_mm_mul_ps(zigzagSin4(_mm_add_ps(time, _mm_mul_ps(y, _mm_set1_ps(0.01f)))), _mm_set1_ps(aiZigzagSpeed)), dt);
+        moved = _mm_add_ps(moved, zigzag);
+        moved = _mm_min_ps(_mm_max_ps(moved, leftLimit), rightLimit);
+        _mm_storeu_ps(&traffic.x[i], select4(visible, moved, x));
+    }
+#endif
+
+    for (; i < n; i++)
+        moveCar(traffic, i, step, steer, aiZigzagSpeed);
+}
@@ -0,0 +1,74 @@
+#ifndef TRAFFIC_H
+#define TRAFFIC_H
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+#include "rng.h"
+
+// Handle to one car that stays valid for as long as the car is on the
+// road: the slot it occupies plus that slot's generation, so a handle to a
+// removed car never finds whichever car reuses the slot.
+typedef uint32_t TrafficHandle;
+const TrafficHandle noTrafficCar = 0xFFFFFFFF;
+
+// AI traffic stored as parallel arrays, one entry per car at the same index
+// in each, so the per-tick movement can work on several cars at once. Cars
+// are packed densely in no particular order; removal moves the last car
+// into the gap. Storage is sized once by reserveTraffic(), so adding and
+// removing cars during a race never allocates.
+struct Traffic {
+    std::vector<float> x, y, speed;
+    std::vector<int> sprite;
+    std::vector<unsigned int> id;
+    std::vector<Rng> rng;
+    std::vector<TrafficHandle> handle;
+
+    // Slot table behind the handles: the index of the car in each slot,
+    // each slot's generation, and the slots not in use.
+    std::vector<uint32_t> slotIndex;
+    std::vector<uint16_t> slotGeneration;
+    std::vector<uint32_t> freeSlots;
+};
+
+size_t trafficCount(const Traffic& traffic);
+size_t trafficCapacity(const Traffic& traffic);
+// Makes room for at least capacity cars. Never shrinks; cars already on
+// the road keep their handles.
+void reserveTraffic(Traffic& traffic, size_t capacity);
+// Removes every car. Handles to them stop resolving.
+void clearTraffic(Traffic& traffic);
+// Returns noTrafficCar, and adds nothing, when the pool is full.
+TrafficHandle addTrafficCar(Traffic& traffic, float x, float y, float speed, int sprite, unsigned int id, const Rng& rng);
+// O(1): the last car takes index i.
+void removeTrafficCar(Traffic& traffic, size_t i);
+// Index of the car behind handle, or trafficCount() if it has gone.
+size_t findTrafficCar(const Traffic& traffic, TrafficHandle handle);
+
+struct TrafficStep {
+    float playerX;
+    float playerSpeed;
+    float aggression;
+    float time;
+    float dt;
+};
+
+// Re-rolls each car's speed around the player's, moves it down the road
+// and, once it is on screen, steers it toward the player, adds the zigzag
+// and keeps it on the road. Uses SSE2 when available; the scalar path does
+// the same arithmetic in the same order so both give identical results.
+void moveTraffic(Traffic& traffic, const TrafficStep& step);
+
+// Narrowphase for a block of cars: bit k of the result is set when the car
+// at (x, y) overlaps car k of xs/ys, by the same test as overlaps(). count
+// may be anything up to collisionBlock; a full block is tested with SIMD
+// compares when available.
+const size_t collisionBlock = 8;
+unsigned int overlapMask(float x, float y, const float* xs, const float* ys, size_t count);
+
+// sin() replacement used for the zigzag: range reduction plus an odd
+// polynomial, cheap to vectorize and the same on every platform.
+float zigzagSin(float x);
+
+#endif